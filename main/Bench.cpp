@@ -0,0 +1,816 @@
+#include "Bench.h"
+#include "AVC.h"
+#include "CNalIndex.h"
+#include "CPacer.h"
+#include "CTimingWheel.h"
+#include "CTcpSendQueue.h"
+#include "CStreamer.h"
+#include "CRtspParser.h"
+#include "CRtspResponses.h"
+#include "CRtspSession.h"
+#include "platglue.h"
+#include <algorithm>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+
+#define BENCH_SYNTHETIC_SIZE (256LL * 1024 * 1024) // the served file repeated up to this size
+#define BENCH_MIN_NS 500000000LL                   // run every measurement at least this long
+
+static int64_t nowNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static uint64_t countStartcodes(StartcodeScanner find, const uint8_t *p, const uint8_t *end)
+{
+    uint64_t n = 0;
+    for (p = find(p, end); p < end; p = find(p + 3, end))
+        ++n;
+    return n;
+}
+
+static void benchBuffer(const char *what, const uint8_t *data, int64_t len)
+{
+    StartcodeScannerInfo scanners[AVC_STARTCODE_SCANNERS_MAX];
+    int n = avc_startcode_scanners(scanners, AVC_STARTCODE_SCANNERS_MAX);
+    uint64_t expected = 0;
+
+    printf("%s, %lld bytes:\n", what, (long long)len);
+    for (int i = 0; i < n; ++i)
+    {
+        uint64_t found = 0;
+        int runs = 0;
+        int64_t start = nowNs(), elapsed;
+        do
+        {
+            found = countStartcodes(scanners[i].find, data, data + len);
+            ++runs;
+            elapsed = nowNs() - start;
+        } while (elapsed < BENCH_MIN_NS);
+
+        if (i == 0)
+            expected = found;
+        printf("  %-6s %8.0f MB/s  %llu start codes%s\n", scanners[i].name,
+               (double)len * runs * 1000.0 / elapsed, (unsigned long long)found,
+               found == expected ? "" : "  MISMATCH");
+    }
+
+    // single threaded and one thread per core (at least 4, so the chunk merging is checked everywhere)
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores < 4)
+        cores = 4;
+    std::vector<NalIndexEntry> reference;
+    for (int threads = 1; threads <= cores; threads = threads == 1 ? cores : cores + 1)
+    {
+        std::vector<NalIndexEntry> entries;
+        int runs = 0;
+        int64_t start = nowNs(), elapsed;
+        do
+        {
+            CNalIndex::build(data, len, entries, threads);
+            ++runs;
+            elapsed = nowNs() - start;
+        } while (elapsed < BENCH_MIN_NS);
+
+        if (threads == 1)
+            reference = entries;
+        bool same = entries.size() == reference.size() &&
+                    memcmp(entries.data(), reference.data(), entries.size() * sizeof(NalIndexEntry)) == 0;
+        printf("  index  %8.0f MB/s  %zu NAL units (%s, %d threads)%s\n", (double)len * runs * 1000.0 / elapsed,
+               entries.size(), avc_startcode_scanner_name(), threads, same ? "" : "  MISMATCH");
+    }
+}
+
+void benchStartcodeScanners(const uint8_t *stream, int64_t stream_len)
+{
+    benchBuffer("served file", stream, stream_len);
+
+    int64_t len = BENCH_SYNTHETIC_SIZE - BENCH_SYNTHETIC_SIZE % stream_len;
+    uint8_t *synthetic = (uint8_t *)malloc((size_t)len);
+    if (!synthetic)
+        return;
+    for (int64_t pos = 0; pos < len; pos += stream_len)
+        memcpy(synthetic + pos, stream, (size_t)stream_len);
+    benchBuffer("synthetic stream (served file repeated)", synthetic, len);
+    free(synthetic);
+}
+
+#define BENCH_SMOOTH_PAYLOAD 1400 // RTP payload per simulated packet
+#define BENCH_SMOOTH_MAX_FRAMES 100000
+
+struct SmoothResult
+{
+    uint64_t peakBytes; // most bytes sent within one frame interval
+    uint64_t totalBytes;
+    uint64_t frames;
+    uint64_t late;      // access units whose last packet left after its deadline
+};
+
+/**
+   Run the pacer over the access units of the index on a virtual clock, released the way SimStreamer
+   releases them, and bin the departure times by frame interval. The stream is looped like the server
+   loops it: it starts smoothFrames + 1 access units before the end of the file, so the first picture
+   of the file is measured in steady state.
+ */
+static SmoothResult simulateSmoothing(const CNalIndex &index, uint64_t frameIntervalNs, int spreadPercent, int smoothFrames)
+{
+    CPacer pacer;
+    pacer.configure(frameIntervalNs, spreadPercent ? spreadPercent : 100, 0, smoothFrames);
+
+    size_t aus = index.accessUnits();
+    uint64_t warmup = (uint64_t)smoothFrames + 1;
+    uint64_t measured = aus < BENCH_SMOOTH_MAX_FRAMES ? aus : BENCH_SMOOTH_MAX_FRAMES;
+    uint64_t frames = warmup + measured;
+    uint64_t first = (aus - warmup % aus) % aus; // access unit of frame 0
+    uint64_t start = 1000000000ULL;              // clear of 0, the pacer's idle state
+    uint64_t spreadNs = frameIntervalNs * (spreadPercent ? spreadPercent : 100) / 100;
+    std::vector<uint64_t> bins(frames + 2);
+    std::vector<RtpPacket> pkts;
+    std::vector<RtpPacket *> ptrs;
+    std::vector<uint64_t> nextBytes(smoothFrames);
+
+    SmoothResult result;
+    memset(&result, 0, sizeof(result));
+    result.frames = measured;
+    uint64_t frame = 0;
+    for (uint64_t tick = 0; frame < frames; ++tick)
+    {
+        uint64_t now = start + tick * frameIntervalNs;
+        for (; frame <= tick + smoothFrames && frame < frames; ++frame)
+        {
+            size_t au = (size_t)((first + frame) % aus);
+            uint64_t bytes = index.accessUnitBytes(au);
+            size_t count = (size_t)((bytes + BENCH_SMOOTH_PAYLOAD - 1) / BENCH_SMOOTH_PAYLOAD);
+            pkts.resize(count);
+            ptrs.resize(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint64_t payload = bytes > BENCH_SMOOTH_PAYLOAD ? BENCH_SMOOTH_PAYLOAD : bytes;
+                bytes -= payload;
+                pkts[i].len = (int)payload + RTP_HEADER_SIZE;
+                ptrs[i] = &pkts[i];
+            }
+            for (size_t i = 0; i < nextBytes.size(); ++i)
+                nextBytes[i] = index.accessUnitBytes((au + 1 + i) % aus);
+
+            pacer.schedule(ptrs.data(), count, now, (int)(frame - tick), nextBytes.data(), nextBytes.size());
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                bins[(pkts[i].due - start) / frameIntervalNs] += pkts[i].len;
+                if (frame >= warmup)
+                    result.totalBytes += pkts[i].len;
+            }
+            if (frame >= warmup && count && pkts[count - 1].due > start + frame * frameIntervalNs + spreadNs)
+                ++result.late;
+        }
+    }
+    for (size_t i = warmup; i < bins.size(); ++i)
+        if (bins[i] > result.peakBytes)
+            result.peakBytes = bins[i];
+    return result;
+}
+
+void benchSmoothing(const CNalIndex &index, int fps, int spreadPercent, int smoothFrames)
+{
+    uint64_t frameIntervalNs = 1000000000ULL / fps;
+    printf("rate smoothing at %d fps, peak and average over frame intervals:\n", fps);
+
+    static const int lookaheads[] = {0, 1, 2, 4, 8, 16, 32};
+    std::vector<int> runs(lookaheads, lookaheads + sizeof(lookaheads) / sizeof(lookaheads[0]));
+    if (smoothFrames > 0 && std::find(runs.begin(), runs.end(), smoothFrames) == runs.end())
+        runs.push_back(smoothFrames);
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        SmoothResult r = simulateSmoothing(index, frameIntervalNs, spreadPercent, runs[i]);
+        double avgKbps = r.totalBytes * 8.0 / (r.frames * frameIntervalNs / 1e9) / 1000;
+        double peakKbps = r.peakBytes * 8.0 / (frameIntervalNs / 1e9) / 1000;
+        printf("  lookahead %2d frames (+%4.0f ms): peak %8.0f kbit/s average %8.0f kbit/s peak/average %5.2f late %llu%s\n", runs[i],
+               runs[i] * frameIntervalNs / 1e6, peakKbps, avgKbps, peakKbps / avgKbps, (unsigned long long)r.late,
+               smoothFrames > 0 && runs[i] == smoothFrames ? " (-a)" : "");
+    }
+}
+
+#define BENCH_TXTIME_PACKETS 50
+#define BENCH_TXTIME_SPACING_NS 500000 // 0.5 ms between departure times
+#define BENCH_TXTIME_SIZE 1200
+
+void benchTxTimeSpacing()
+{
+    printf("SO_TXTIME on loopback, %d packets %d us apart:\n", BENCH_TXTIME_PACKETS, BENCH_TXTIME_SPACING_NS / 1000);
+
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    timeval timeout = {1, 0};
+    if (rx < 0 || tx < 0 || bind(rx, (sockaddr *)&addr, sizeof(addr)) != 0 || getsockname(rx, (sockaddr *)&addr, &addrlen) != 0 ||
+        setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0)
+    {
+        printf("  can't set up loopback sockets errno=%d\n", errno);
+        close(rx);
+        close(tx);
+        return;
+    }
+    if (!udpsocketenabletxtime(tx))
+    {
+        printf("  SO_TXTIME not available (errno=%d), the server would pace in userspace\n", errno);
+        close(rx);
+        close(tx);
+        return;
+    }
+
+    // the whole burst in one sendmmsg, like a paced access unit
+    static uint8_t payload[BENCH_TXTIME_SIZE];
+    iovec iovs[BENCH_TXTIME_PACKETS];
+    mmsghdr msgs[BENCH_TXTIME_PACKETS];
+    char txtimes[BENCH_TXTIME_PACKETS][UDP_TXTIME_CONTROL_SIZE];
+    uint64_t start = (uint64_t)nowNs() + 1000000;
+    for (int i = 0; i < BENCH_TXTIME_PACKETS; ++i)
+    {
+        iovs[i].iov_base = payload;
+        iovs[i].iov_len = sizeof(payload);
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        udpmsgsettxtime(&msgs[i].msg_hdr, txtimes[i], start + (uint64_t)i * BENCH_TXTIME_SPACING_NS);
+    }
+    uint64_t calls = 0;
+    int sent = udpsocketsendmmsg(tx, msgs, BENCH_TXTIME_PACKETS, &calls);
+    if (sent < BENCH_TXTIME_PACKETS)
+        printf("  sendmmsg sent %d errno=%d\n", sent, errno);
+
+    std::vector<int64_t> arrivals;
+    uint8_t buf[2048];
+    while ((int)arrivals.size() < sent && recv(rx, buf, sizeof(buf), 0) > 0)
+        arrivals.push_back(nowNs());
+    close(rx);
+    close(tx);
+
+    if (arrivals.size() < 2)
+    {
+        printf("  received %zu packets\n", arrivals.size());
+        return;
+    }
+    std::vector<int64_t> gaps;
+    for (size_t i = 1; i < arrivals.size(); ++i)
+        gaps.push_back(arrivals[i] - arrivals[i - 1]);
+    std::sort(gaps.begin(), gaps.end());
+    int64_t span = arrivals.back() - arrivals.front();
+    int64_t expected = (int64_t)(arrivals.size() - 1) * BENCH_TXTIME_SPACING_NS;
+
+    printf("  received %zu, spacing min %.3f median %.3f max %.3f ms, span %.2f ms (expected %.2f ms)\n", arrivals.size(),
+           gaps.front() / 1e6, gaps[gaps.size() / 2] / 1e6, gaps.back() / 1e6, span / 1e6, expected / 1e6);
+    if (span * 10 >= expected * 9)
+        printf("  departure times are honored\n");
+    else
+        printf("  departure times are ignored, the interface needs the fq qdisc (tc qdisc replace dev lo root fq)\n");
+}
+
+#define BENCH_WHEEL_TIMERS 100000     // stream clocks on the virtual clock
+#define BENCH_WHEEL_SECONDS 3         // of virtual time
+#define BENCH_WHEEL_LOOP_TIMERS 2000  // stream clocks in the event loop
+#define BENCH_WHEEL_LOOP_NS 3000000000LL
+#define BENCH_WHEEL_LOAD_BYTES 16384  // copied per frame, stands in for packetizing
+
+static const int benchFrameRates[] = {24, 25, 30, 50, 60};
+
+/**
+   A stream clock: re-arms itself one frame period later, on absolute deadlines, and records how
+   late it fired.
+ */
+class BenchClock : public CWheelTimer
+{
+public:
+    CTimingWheel *m_Wheel;
+    uint64_t m_PeriodNs;
+    std::vector<uint64_t> *m_Lateness; // NULL on the virtual clock
+    uint8_t *m_Load;
+
+    virtual void onTimer(uint64_t expiredNs)
+    {
+        if (m_Lateness)
+        {
+            int64_t now = nowNs(); // later ones of a batch wait for the work of the earlier ones
+            m_Lateness->push_back(now > (int64_t)getDeadline() ? now - getDeadline() : 0);
+            memcpy(m_Load, m_Load + BENCH_WHEEL_LOAD_BYTES, BENCH_WHEEL_LOAD_BYTES);
+        }
+        m_Wheel->add(this, getDeadline() + m_PeriodNs);
+    }
+};
+
+/// mixed frame rates and random phases
+static void startClocks(std::vector<BenchClock> &clocks, CTimingWheel &wheel, uint64_t startNs, std::vector<uint64_t> *lateness,
+                        uint8_t *load)
+{
+    for (size_t i = 0; i < clocks.size(); ++i)
+    {
+        clocks[i].m_Wheel = &wheel;
+        clocks[i].m_PeriodNs = 1000000000ULL / benchFrameRates[i % (sizeof(benchFrameRates) / sizeof(benchFrameRates[0]))];
+        clocks[i].m_Lateness = lateness;
+        clocks[i].m_Load = load;
+        wheel.add(&clocks[i], startNs + (uint64_t)rand() % clocks[i].m_PeriodNs);
+    }
+}
+
+void benchTimingWheel()
+{
+    printf("timing wheel, %llu us ticks:\n", (unsigned long long)(TIMINGWHEEL_TICK_NS / 1000));
+
+    // 1. arm and cancel far apart deadlines
+    {
+        std::vector<BenchClock> timers(BENCH_WHEEL_TIMERS);
+        CTimingWheel wheel(0);
+        int64_t start = nowNs();
+        uint64_t ops = 0;
+        for (int round = 0; round < 10; ++round)
+        {
+            for (size_t i = 0; i < timers.size(); ++i)
+                wheel.add(&timers[i], (uint64_t)rand() * 1000);
+            for (size_t i = 0; i < timers.size(); ++i)
+                wheel.cancel(&timers[i]);
+            ops += 2 * timers.size();
+        }
+        printf("  add + cancel     %6.1f M ops/s\n", ops * 1000.0 / (nowNs() - start));
+    }
+
+    // 2. stream clocks firing on a virtual clock that advances tick by tick
+    {
+        std::vector<BenchClock> clocks(BENCH_WHEEL_TIMERS);
+        CTimingWheel wheel(0);
+        startClocks(clocks, wheel, TIMINGWHEEL_TICK_NS, NULL, NULL);
+        uint64_t fired = 0;
+        int64_t start = nowNs();
+        for (uint64_t now = 0; now < BENCH_WHEEL_SECONDS * 1000000000ULL; now += TIMINGWHEEL_TICK_NS)
+            fired += wheel.expire(now);
+        int64_t took = nowNs() - start;
+        printf("  %d clocks       %6.1f M expirations/s (%llu in %d s virtual time, %.1f ms cpu)\n", BENCH_WHEEL_TIMERS,
+               fired * 1000.0 / took, (unsigned long long)fired, BENCH_WHEEL_SECONDS, took / 1e6);
+    }
+
+    // 3. lateness of stream clocks in an event loop, with some work per frame
+    {
+        CEventLoop loop;
+        CTimingWheel wheel((uint64_t)nowNs());
+        std::vector<BenchClock> clocks(BENCH_WHEEL_LOOP_TIMERS);
+        std::vector<uint64_t> lateness;
+        std::vector<uint8_t> load(2 * BENCH_WHEEL_LOAD_BYTES);
+        if (!wheel.init(&loop))
+            return;
+        lateness.reserve(BENCH_WHEEL_LOOP_NS / 1000000000LL * 60 * BENCH_WHEEL_LOOP_TIMERS);
+        startClocks(clocks, wheel, (uint64_t)nowNs(), &lateness, load.data());
+
+        int64_t end = nowNs() + BENCH_WHEEL_LOOP_NS;
+        uint64_t wakeups = 0;
+        while (nowNs() < end)
+            wakeups += loop.runOnce(100);
+        for (size_t i = 0; i < clocks.size(); ++i)
+            wheel.cancel(&clocks[i]);
+
+        if (lateness.empty())
+            return;
+        std::sort(lateness.begin(), lateness.end());
+        printf("  %d clocks in the event loop: %zu frames in %llu wakeups, lateness p50 %.3f p99 %.3f max %.3f ms\n",
+               BENCH_WHEEL_LOOP_TIMERS, lateness.size(), (unsigned long long)wakeups, lateness[lateness.size() / 2] / 1e6,
+               lateness[lateness.size() * 99 / 100] / 1e6, lateness.back() / 1e6);
+    }
+}
+
+#define BENCH_TCP_BYTES (512LL * 1024 * 1024) // sent per mode
+#define BENCH_TCP_PACKET 1400                  // payload per packet, like FU fragments
+#define BENCH_TCP_FRAME_PACKETS 48             // packets per access unit, ~64 KB pictures
+
+static int64_t threadCpuNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// a connected loopback TCP pair, the receiver drained by a thread until the sender closes
+static bool tcpLoopbackPair(int *tx, int *rx)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    *tx = socket(AF_INET, SOCK_STREAM, 0);
+    bool ok = listener >= 0 && *tx >= 0 && bind(listener, (sockaddr *)&addr, sizeof(addr)) == 0 && listen(listener, 1) == 0 &&
+              getsockname(listener, (sockaddr *)&addr, &addrlen) == 0 && connect(*tx, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+              (*rx = accept(listener, NULL, NULL)) >= 0;
+    close(listener);
+    return ok;
+}
+
+static void drain(int rx)
+{
+    static uint8_t buf[256 * 1024];
+    while (recv(rx, buf, sizeof(buf), 0) > 0)
+        ;
+}
+
+enum TcpSendMode { tcpSendPerPacket, tcpSendQueue, tcpSendZeroCopy };
+
+static void benchTcpMode(const char *what, TcpSendMode mode, std::vector<RtpPacket *> &pkts)
+{
+    int tx = -1, rx = -1;
+    if (!tcpLoopbackPair(&tx, &rx))
+    {
+        printf("  can't set up a loopback connection errno=%d\n", errno);
+        close(tx);
+        return;
+    }
+    std::thread reader(drain, rx);
+
+    CTcpSendQueue *queue = new CTcpSendQueue();
+    if (mode == tcpSendZeroCopy)
+        queue->useZeroCopy(tx);
+
+    uint8_t hdr[RTP_TCP_HEADER_SIZE + RTP_HEADER_SIZE];
+    iovec iov[1 + RTP_PACKET_MAX_CHUNKS];
+    uint64_t syscalls = 0;
+    int64_t bytes = 0;
+    int64_t start = nowNs(), cpuStart = threadCpuNs();
+    for (size_t next = 0; bytes < BENCH_TCP_BYTES; next = (next + BENCH_TCP_FRAME_PACKETS) % pkts.size())
+    {
+        for (size_t i = next; i < next + BENCH_TCP_FRAME_PACKETS && i < pkts.size(); ++i)
+        {
+            RtpPacket *pkt = pkts[i];
+            memcpy(hdr, rtpPacketTcpHeader(pkt), sizeof(hdr));
+            bytes += sizeof(hdr) + pkt->len - RTP_HEADER_SIZE;
+            if (mode != tcpSendPerPacket)
+            {
+                queue->push(pkt, hdr);
+                continue;
+            }
+            // the send path before the queue: one blocking sendmsg per packet
+            iov[0].iov_base = hdr;
+            iov[0].iov_len = sizeof(hdr);
+            memcpy(&iov[1], pkt->chunk, pkt->chunks * sizeof(iovec));
+            socketsendv(tx, iov, 1 + pkt->chunks);
+            ++syscalls;
+        }
+
+        // the reader is slower now and then, wait for room like the event loop would
+        while (mode != tcpSendPerPacket && (!queue->flush(tx, &syscalls) || !queue->empty()))
+        {
+            pollfd pfd = {tx, POLLOUT, 0};
+            poll(&pfd, 1, 1000);
+            if (pfd.revents & POLLERR)
+                queue->reap(tx);
+        }
+    }
+    int64_t cpu = threadCpuNs() - cpuStart, elapsed = nowNs() - start;
+    delete queue;
+
+    shutdown(tx, SHUT_WR);
+    reader.join();
+    close(tx);
+    close(rx);
+
+    printf("  %-26s %6.0f MB/s, sender CPU %5.2f s/GB, %6.1f KB per send call\n", what, bytes / (elapsed / 1e3),
+           cpu / 1e9 / (bytes / 1e9), syscalls ? bytes / 1024.0 / syscalls : 0.0);
+}
+
+void benchTcpSend(const uint8_t *stream, int64_t stream_len)
+{
+    printf("RTP over RTSP on loopback, %d byte packets, %d per picture:\n", BENCH_TCP_PACKET, BENCH_TCP_FRAME_PACKETS);
+    if (stream_len < BENCH_TCP_PACKET)
+        return;
+
+    // packets referencing the file in place, like the packetizer builds them
+    std::vector<RtpPacket *> pkts;
+    for (int64_t offset = 0; offset + BENCH_TCP_PACKET <= stream_len && pkts.size() < 4096; offset += BENCH_TCP_PACKET)
+    {
+        RtpPacket *pkt = rtpPacketAlloc();
+        uint8_t *tcp = rtpPacketTcpHeader(pkt);
+        int len = RTP_HEADER_SIZE + BENCH_TCP_PACKET;
+        tcp[0] = '$';
+        tcp[1] = 0;
+        tcp[2] = (uint8_t)(len >> 8);
+        tcp[3] = (uint8_t)len;
+        rtpPacketAddRef(pkt, stream + offset, BENCH_TCP_PACKET);
+        pkt->len = len;
+        pkts.push_back(pkt);
+    }
+
+    benchTcpMode("sendmsg per packet", tcpSendPerPacket, pkts);
+    benchTcpMode("queued, gathered sendmsg", tcpSendQueue, pkts);
+    benchTcpMode("queued, MSG_ZEROCOPY", tcpSendZeroCopy, pkts);
+
+    for (size_t i = 0; i < pkts.size(); ++i)
+        rtpPacketUnref(pkts[i]);
+}
+
+#define BENCH_POOL_FRAME 48 // packets alive at once, one access unit
+#define BENCH_POOL_THREADS 4
+
+// build and release access units of packets until BENCH_MIN_NS passed, returns ns per packet
+static double poolRound(bool pool)
+{
+    RtpPacket *pkts[BENCH_POOL_FRAME];
+    uint64_t count = 0;
+    int64_t start = nowNs(), elapsed;
+    do
+    {
+        for (int round = 0; round < 1000; ++round)
+        {
+            for (int i = 0; i < BENCH_POOL_FRAME; ++i)
+            {
+                pkts[i] = pool ? rtpPacketAlloc() : (RtpPacket *)malloc(sizeof(RtpPacket));
+                pkts[i]->refs = 1;
+            }
+            for (int i = 0; i < BENCH_POOL_FRAME; ++i)
+            {
+                if (pool)
+                    rtpPacketUnref(pkts[i]);
+                else
+                    free(pkts[i]);
+            }
+        }
+        count += 1000 * BENCH_POOL_FRAME;
+        elapsed = nowNs() - start;
+    } while (elapsed < BENCH_MIN_NS);
+    return (double)elapsed / count;
+}
+
+void benchPacketPool()
+{
+    printf("packet pool, %d packets of %zu bytes alive at once:\n", BENCH_POOL_FRAME, sizeof(RtpPacket));
+    printf("  malloc/free         %6.1f ns per packet\n", poolRound(false));
+    printf("  pool                %6.1f ns per packet\n", poolRound(true));
+
+    // workers allocate from their own caches, the shared list is only touched per batch
+    std::vector<double> perThread(BENCH_POOL_THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < BENCH_POOL_THREADS; ++t)
+        threads.push_back(std::thread([&perThread, t] { perThread[t] = poolRound(true); }));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    double rate = 0; // packets per ns of all threads together
+    for (size_t t = 0; t < perThread.size(); ++t)
+        rate += 1.0 / perThread[t];
+    printf("  pool, %d threads     %6.1f ns per packet, all threads together\n", BENCH_POOL_THREADS, 1.0 / rate);
+
+    RtpPacketPoolStats stats;
+    rtpPacketPoolGetStats(&stats);
+    printf("  %llu packets in %d arenas%s, high water %llu\n", (unsigned long long)stats.capacity, stats.arenas,
+           stats.hugepages ? " on hugepages" : "", (unsigned long long)stats.highWater);
+}
+
+#define BENCH_URING_PACKET 1200      // payload per UDP packet
+#define BENCH_URING_FRAME_PACKETS 48 // packets per access unit, linked on the ring
+#define BENCH_URING_MS 1000          // length of each run
+
+static const int benchUringRates[] = {1000, 5000, 10000}; // packets per ms
+
+// fan packets out to a loopback UDP port nobody reads, ratePerMs every ms, with sendmmsg or through ring
+// (linked per access unit like the streamer does, or not)
+static void benchUringRate(const char *what, CIoUring *ring, bool linked, int sock, const sockaddr_in *dest, std::vector<RtpPacket *> &pkts,
+                           int ratePerMs)
+{
+    uint8_t hdrs[RTP_SENDMMSG_BATCH][RTP_HEADER_SIZE];
+    iovec iovs[RTP_SENDMMSG_BATCH][1 + RTP_PACKET_MAX_CHUNKS];
+    mmsghdr msgs[RTP_SENDMMSG_BATCH];
+    uint64_t syscalls = 0, packets = 0;
+    uint64_t enters = ring ? ring->getEnters() : 0, failed = ring ? ring->getFailed() : 0;
+    size_t next = 0;
+
+    int64_t start = nowNs(), cpuStart = threadCpuNs();
+    for (int ms = 0; ms < BENCH_URING_MS; ++ms)
+    {
+        // wait for the tick unless we fell behind, a run that can't keep up ends after BENCH_URING_MS all the same
+        int64_t due = start + ms * 1000000LL, now = nowNs();
+        if (now - start >= BENCH_URING_MS * 1000000LL)
+            break;
+        if (due > now)
+        {
+            timespec ts = {0, (long)(due - now)};
+            nanosleep(&ts, NULL);
+        }
+
+        for (int sent = 0; sent < ratePerMs;)
+        {
+            int n = 0;
+            for (; n < RTP_SENDMMSG_BATCH && sent + n < ratePerMs; ++n)
+            {
+                RtpPacket *pkt = pkts[(next + n) % pkts.size()];
+                memcpy(hdrs[n], rtpPacketTcpHeader(pkt) + RTP_TCP_HEADER_SIZE, RTP_HEADER_SIZE);
+                if (ring)
+                {
+                    if (linked && (packets + n) % BENCH_URING_FRAME_PACKETS == 0) // room for the whole chain first, as the streamer does
+                    {
+                        int left = ratePerMs - sent - n;
+                        ring->reserve(left < BENCH_URING_FRAME_PACKETS ? left : BENCH_URING_FRAME_PACKETS);
+                    }
+                    bool link = linked && (packets + n + 1) % BENCH_URING_FRAME_PACKETS != 0 && sent + n + 1 < ratePerMs;
+                    ring->sendUdp(sock, dest, pkt, hdrs[n], 0, link);
+                    continue;
+                }
+                iovs[n][0].iov_base = hdrs[n];
+                iovs[n][0].iov_len = RTP_HEADER_SIZE;
+                memcpy(&iovs[n][1], pkt->chunk, pkt->chunks * sizeof(iovec));
+                memset(&msgs[n], 0, sizeof(msgs[n]));
+                msgs[n].msg_hdr.msg_name = (void *)dest;
+                msgs[n].msg_hdr.msg_namelen = sizeof(*dest);
+                msgs[n].msg_hdr.msg_iov = iovs[n];
+                msgs[n].msg_hdr.msg_iovlen = 1 + pkt->chunks;
+            }
+            if (!ring)
+                udpsocketsendmmsg(sock, msgs, n, &syscalls);
+            next += n;
+            sent += n;
+            packets += n;
+        }
+        if (ring)
+            ring->submit(); // one io_uring_enter per tick, unless the ring filled up before
+    }
+    int64_t cpu = threadCpuNs() - cpuStart, elapsed = nowNs() - start;
+    if (ring)
+        syscalls = ring->getEnters() - enters;
+
+    printf("  %-16s %5d pkts/ms: %7.0f pkts/ms sent, %8.0f syscalls/s, CPU %3.0f%%, %5.0f ns per packet%s\n", what, ratePerMs,
+           packets / (elapsed / 1e6), syscalls / (elapsed / 1e9), 100.0 * cpu / elapsed, (double)cpu / packets,
+           ring && ring->getFailed() != failed ? " (sends failed)" : "");
+}
+
+void benchIoUring(const uint8_t *stream, int64_t stream_len)
+{
+    printf("UDP fan out on loopback, %d byte packets, sendmmsg against io_uring:\n", BENCH_URING_PACKET);
+    if (stream_len < BENCH_URING_PACKET)
+        return;
+
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t destlen = sizeof(dest);
+    if (rx < 0 || tx < 0 || bind(rx, (sockaddr *)&dest, sizeof(dest)) != 0 || getsockname(rx, (sockaddr *)&dest, &destlen) != 0)
+    {
+        printf("  can't set up loopback sockets errno=%d\n", errno);
+        close(rx);
+        close(tx);
+        return;
+    }
+
+    std::vector<RtpPacket *> pkts;
+    for (int64_t offset = 0; offset + BENCH_URING_PACKET <= stream_len && pkts.size() < 4096; offset += BENCH_URING_PACKET)
+    {
+        RtpPacket *pkt = rtpPacketAlloc();
+        rtpPacketAddRef(pkt, stream + offset, BENCH_URING_PACKET);
+        pkt->len = RTP_HEADER_SIZE + BENCH_URING_PACKET;
+        pkts.push_back(pkt);
+    }
+
+    CIoUring ring;
+    bool haveRing = ring.init(NULL);
+    for (size_t r = 0; r < sizeof(benchUringRates) / sizeof(benchUringRates[0]); ++r)
+    {
+        benchUringRate("sendmmsg", NULL, false, tx, &dest, pkts, benchUringRates[r]);
+        if (!haveRing)
+            continue;
+        benchUringRate("io_uring", &ring, false, tx, &dest, pkts, benchUringRates[r]);
+        benchUringRate("io_uring, linked", &ring, true, tx, &dest, pkts, benchUringRates[r]);
+    }
+
+    for (size_t i = 0; i < pkts.size(); ++i)
+        rtpPacketUnref(pkts[i]);
+    close(rx);
+    close(tx);
+}
+
+// a client's session setup, as VLC sends it
+static const char benchRtspRequests[] =
+    "OPTIONS rtsp://192.168.1.20:554/live/1 RTSP/1.0\r\nCSeq: 2\r\nUser-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n\r\n"
+    "DESCRIBE rtsp://192.168.1.20:554/live/1 RTSP/1.0\r\nCSeq: 3\r\nUser-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n"
+    "Accept: application/sdp\r\n\r\n"
+    "SETUP rtsp://192.168.1.20:554/live/1/track1 RTSP/1.0\r\nCSeq: 4\r\nUser-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n"
+    "Transport: RTP/AVP;unicast;client_port=56742-56743\r\n\r\n"
+    "PLAY rtsp://192.168.1.20:554/live/1/ RTSP/1.0\r\nCSeq: 5\r\nUser-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n"
+    "Session: 8A3F21C0\r\nRange: npt=0.000-\r\n\r\n"
+    "SET_PARAMETER rtsp://192.168.1.20:554/live/1/ RTSP/1.0\r\nCSeq: 6\r\nSession: 8A3F21C0\r\nContent-Type: text/parameters\r\n"
+    "Content-Length: 19\r\n\r\nbarparam: barstuff\n";
+
+// parse the requests over and over, handed over readSize bytes at a time; returns ns per request
+static double parserRound(size_t readSize, unsigned *checksum)
+{
+    const size_t len = sizeof(benchRtspRequests) - 1;
+    CRtspParser parser(len);
+    RtspRequest req;
+    uint64_t requests = 0;
+    int64_t start = nowNs(), elapsed;
+    do
+    {
+        for (int round = 0; round < 1000; ++round)
+        {
+            size_t done = 0, avail = 0;
+            while (done < len)
+            {
+                avail = avail + readSize < len ? avail + readSize : len;
+                int used;
+                while ((used = parser.parse(benchRtspRequests + done, avail - done, &req)) > 0)
+                {
+                    done += used;
+                    *checksum += req.cseq + req.method;
+                    ++requests;
+                }
+                if (used < 0 || (used == 0 && avail == len && done < len))
+                    return 0;
+            }
+        }
+        elapsed = nowNs() - start;
+    } while (elapsed < BENCH_MIN_NS);
+    return (double)elapsed / requests;
+}
+
+void benchRtspParser()
+{
+    printf("RTSP request parser, %zu bytes of 5 requests:\n", sizeof(benchRtspRequests) - 1);
+    unsigned checksum = 0;
+    static const size_t readSizes[] = {sizeof(benchRtspRequests), 64, 16};
+    for (size_t i = 0; i < sizeof(readSizes) / sizeof(readSizes[0]); ++i)
+    {
+        double ns = parserRound(readSizes[i], &checksum);
+        if (i == 0)
+            printf("  pipelined, one read    %6.0f ns per request, %5.2f M requests/s\n", ns, 1e3 / ns);
+        else
+            printf("  %3zu byte reads          %6.0f ns per request, %5.2f M requests/s\n", readSizes[i], ns, 1e3 / ns);
+    }
+    if (!checksum)
+        printf("  (parse failed)\n");
+}
+
+// the PLAY answer as it used to be built: formatted, with a fresh Date line
+static size_t playSnprintf(char *out, size_t size, unsigned cseq, int session)
+{
+    char date[64];
+    struct tm tm;
+    time_t tt = time(NULL);
+    strftime(date, sizeof(date), "Date: %a, %b %d %Y %H:%M:%S GMT", gmtime_r(&tt, &tm));
+    return snprintf(out, size,
+                    "RTSP/1.0 200 OK\r\nCSeq: %u\r\n"
+                    "%s\r\n"
+                    "Range: npt=0.000-\r\n"
+                    "Session: %i\r\n"
+                    "RTP-Info: url=rtsp://127.0.0.1:554/live/1/track1\r\n\r\n",
+                    cseq, date, session);
+}
+
+void benchRtspResponses(CStreamer &streamer)
+{
+    printf("RTSP responses:\n");
+    const CRtspResponses &responses = streamer.getResponses();
+    char out[RTSP_RESPONSE_SIZE];
+    RtspResponseArgs args;
+    memset(&args, 0, sizeof(args));
+    args.session = (int)0x8badf00d;
+    args.host.ptr = "192.168.1.20:554";
+    args.host.len = 16;
+    args.presentation.ptr = "live";
+    args.presentation.len = 4;
+    args.stream.ptr = "1";
+    args.stream.len = 1;
+    args.serverAddr.ptr = "192.168.1.10";
+    args.serverAddr.len = 12;
+
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        static const char *const what[] = {"PLAY, snprintf + strftime", "PLAY, template", "DESCRIBE, template"};
+        uint64_t count = 0, bytes = 0;
+        int64_t start = nowNs(), elapsed;
+        do
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                ++args.cseq;
+                if (mode == 0)
+                    bytes += playSnprintf(out, sizeof(out), args.cseq, args.session);
+                else if (mode == 1)
+                    bytes += responses.play.render(out, sizeof(out), args);
+                else
+                    bytes += responses.renderDescribe(out, sizeof(out), args);
+            }
+            count += 1000;
+            elapsed = nowNs() - start;
+        } while (elapsed < BENCH_MIN_NS);
+        printf("  %-26s %6.0f ns per response, %5.2f M responses/s (%llu bytes)\n", what[mode], (double)elapsed / count,
+               count * 1e3 / elapsed, (unsigned long long)(bytes / count));
+    }
+}
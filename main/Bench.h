@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+class CNalIndex;
+class CStreamer;
+
+/**
+   Microbenchmarks of the testserver (-b), run on the served file and on larger synthetic streams.
+ */
+
+/// start code scanners (scalar, SSE2, AVX2, NEON) and NAL indexing throughput
+void benchStartcodeScanners(const uint8_t *stream, int64_t stream_len);
+
+/// peak to average bitrate of the file with pacing alone and with lookahead smoothing (-a)
+void benchSmoothing(const CNalIndex &index, int fps, int spreadPercent, int smoothFrames);
+
+/// send a burst with SO_TXTIME departure times over loopback and check the spacing on arrival
+void benchTxTimeSpacing();
+
+/// add/cancel and expiry rate of the timing wheel, and the lateness of many stream clocks on it in an event loop
+void benchTimingWheel();
+
+/// CPU cost of RTP over RTSP sends on loopback: per packet, gathered through CTcpSendQueue, and with MSG_ZEROCOPY
+void benchTcpSend(const uint8_t *stream, int64_t stream_len);
+
+/// packet allocation from the pool against malloc, on one and on several threads
+void benchPacketPool();
+
+/// UDP fan out on loopback at 1000, 5000 and 10000 packets per ms: sendmmsg batches against one io_uring_enter per ms
+void benchIoUring(const uint8_t *stream, int64_t stream_len);
+
+/// requests per second of the RTSP parser, pipelined in one read and trickling in
+void benchRtspParser();
+
+/// RTSP responses rendered from the stream's templates against formatting them each time
+void benchRtspResponses(CStreamer &streamer);
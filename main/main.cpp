@@ -1,111 +1,302 @@
-#include "platglue.h"
-
-#include "SimStreamer.h"
-#include "CRtspSession.h"
-#include <assert.h>
-#include <sys/time.h>
-#include "RTPEnc.h"
-#include "Utils.h"
-#include "Network.h"
-
-void printtime(int counter)
-{
-    struct timeval nowt;
-    gettimeofday(&nowt, NULL); // crufty msecish timer
-    uint32_t msect = nowt.tv_sec * 1000 + nowt.tv_usec / 1000;
-    printf("time[%d] : %u ms\r\n", counter, msect);
-}
-RTPMuxContext rtpMuxContext;
-uint8_t *stream = NULL;
-int stream_len = 0;
-// const char *fileName = "../sample_960x540.hevc";
-const char *fileName = "../sample_1280x720.hevc";
-
-void workerThread(SOCKET s)
-{
-    SimStreamer streamer(true); // our streamer for UDP/TCP based RTP transport.
-    streamer.addSession(s)->debug = false;
-
-    uint8_t *stream_buf = stream;
-    int stream_len_temp = stream_len;
-    while (streamer.anySessions())
-    {
-        uint32_t timeout = 10;
-        if (!streamer.handleRequests(timeout))
-        {
-            uint8_t *nal = nullptr;
-            int nal_len = 0;
-            streamer.SelectNextNal(stream_buf, stream_len_temp, nal, nal_len);
-            streamer.StreamNal(&rtpMuxContext, nal, nal_len);
-            rtpMuxContext.timestamp += (90000.0 / 30);
-            usleep(1000000 / 30);
-            // static int Cseq = 0;
-            // printf("#%d, size %d \t\r", Cseq++, nal_len);
-            fflush(stdout);
-
-            if (stream_len_temp <= 0)
-            {
-                stream_buf = stream;
-                stream_len_temp = stream_len;
-                printf("End of the file %s , Restart the streaming file again...\n", fileName);
-            }
-        }
-    }
-    printf("End the Session\n");
-}
-
-int main()
-{
-    initRTPMuxContext(&rtpMuxContext);
-    int res = readFile(&stream, &stream_len, fileName);
-    if (res)
-    {
-        printf("readFile error.\n");
-        return -1;
-    }
-
-    SOCKET MasterSocket;    // our masterSocket(socket that listens for RTSP client connections)
-    SOCKET ClientSocket;    // RTSP socket to handle an client
-    sockaddr_in ServerAddr; // server address parameters
-    sockaddr_in ClientAddr; // address parameters of a new RTSP client
-    socklen_t ClientAddrLen = sizeof(ClientAddr);
-
-    printf("running test RTSP server\n");
-
-    ServerAddr.sin_family = AF_INET;
-    ServerAddr.sin_addr.s_addr = INADDR_ANY;
-    ServerAddr.sin_port = htons(554); // listen on RTSP port 554
-    MasterSocket = socket(AF_INET, SOCK_STREAM, 0);
-
-    int enable = 1;
-    if (setsockopt(MasterSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
-    {
-        printf("setsockopt(SO_REUSEADDR) failed");
-        return 0;
-    }
-
-    // bind our master socket to the RTSP port and listen for a client connection
-    if (bind(MasterSocket, (sockaddr *)&ServerAddr, sizeof(ServerAddr)) != 0)
-    {
-        printf("error can't bind port errno=%d\n", errno);
-
-        return 0;
-    }
-
-    if (listen(MasterSocket, 5) != 0)
-        return 0;
-
-    while (true)
-    { // loop forever to accept client connections
-        ClientSocket = accept(MasterSocket, (struct sockaddr *)&ClientAddr, &ClientAddrLen);
-        printf("Client connected. Client address: %s\r\n", inet_ntoa(ClientAddr.sin_addr));
-        if (fork() == 0)
-        {
-            workerThread(ClientSocket);
-            break;
-        }
-    }
-    closesocket(MasterSocket);
-
-    return 0;
-}
+#include "platglue.h"
+
+#include "SimStreamer.h"
+#include "CRtspSession.h"
+#include <assert.h>
+#include <sys/time.h>
+#include <time.h>
+#include "RTPEnc.h"
+#include "Utils.h"
+#include "Network.h"
+#include "CRtspServer.h"
+#include "CFileSource.h"
+#include "CNalIndex.h"
+#include "CH265ParamSets.h"
+#include "Bench.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <thread>
+#include <vector>
+
+void printtime(int counter)
+{
+    struct timeval nowt;
+    gettimeofday(&nowt, NULL); // crufty msecish timer
+    uint32_t msect = nowt.tv_sec * 1000 + nowt.tv_usec / 1000;
+    printf("time[%d] : %u ms\r\n", counter, msect);
+}
+CFileSource source; // memory mapped, shared by all sessions, threads and forked processes
+CNalIndex nalIndex; // NAL units of source, built once and kept in a sidecar file
+uint8_t *stream = NULL;
+int64_t stream_len = 0;
+const char *fileName = "../sample_960x540.hevc";
+// const char *fileName = "../sample_1280x720.hevc";
+
+RtspServerConfig serverConfig;
+
+static int64_t monotonicNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void workerThread(SOCKET s)
+{
+    SimStreamer streamer(stream, stream_len, &nalIndex, serverConfig.fps); // our streamer for UDP/TCP based RTP transport.
+    streamer.addSession(s)->debug = false;
+
+    // one access unit per frame period, on absolute deadlines so the clock does not drift
+    int64_t period = 1000000000LL / serverConfig.fps;
+    int64_t deadline = monotonicNs() + period;
+    streamer.setTxFlags(serverConfig.txFlags);
+    streamer.setPacing(period, serverConfig.paceSpreadPercent, serverConfig.paceKbps, serverConfig.paceSmoothFrames);
+    while (streamer.anySessions())
+    {
+        // paced packets of the last access unit may be due before the next one
+        int64_t wake = deadline;
+        int64_t due = streamer.isPaced() ? (int64_t)streamer.sendPacedPackets() : 0;
+        if (due && due < wake)
+            wake = due;
+
+        int64_t left = wake - monotonicNs();
+        if (left >= 1000000) // serve requests until the next frame or packet is due
+        {
+            streamer.handleRequests((uint32_t)(left / 1000000));
+            continue;
+        }
+        if (left > 0)
+        {
+            timespec at;
+            at.tv_sec = wake / 1000000000LL;
+            at.tv_nsec = wake % 1000000000LL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+        }
+        if (wake != deadline)
+            continue;
+
+        streamer.streamImage(0);
+        fflush(stdout);
+
+        deadline += period;
+        if (monotonicNs() - deadline > RTSP_MAX_CATCHUP_FRAMES * period) // far behind, don't burst to catch up
+            deadline = monotonicNs() + period;
+    }
+    printf("End the Session\n");
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-f] [-w workers] [-l] [-G speed] [-s seconds] [-g] [-c] [-z] [-U] [-H] [-p percent] [-k kbps] [-a frames] [-T] [-b] [file.hevc]\n"
+           "  -f  legacy mode: fork one process per client (default: single process epoll server)\n"
+           "  -w  number of event loop threads, each pinned to a core with its own SO_REUSEPORT listener\n"
+           "  -l  live: all viewers share one stream that is packetized once (default: each viewer starts at the file start)\n"
+           "  -G  live: keep the GOP of the last IRAP, viewers joining later get it at this many times real time first (2 or more)\n"
+           "  -s  print transmit statistics (packets/s, syscalls per frame, ...) every given seconds\n"
+           "  -g  send runs of equal sized UDP packets with one UDP_SEGMENT (GSO) sendmsg\n"
+           "  -c  give every UDP viewer its own connect()ed socket, so sends carry no address and reuse the cached route\n"
+           "  -z  send large RTP over RTSP (TCP) batches with MSG_ZEROCOPY, from the file pages in place\n"
+           "  -U  send through io_uring: the sends of a frame to all viewers go to the kernel with one io_uring_enter\n"
+           "  -H  back the packet pool with hugepages (MAP_HUGETLB, needs vm.nr_hugepages)\n"
+           "  -p  pace: spread the packets of each picture over this percentage of the frame interval\n"
+           "  -k  pace: send at least at this bitrate (with or without -p)\n"
+           "  -a  pace: smooth the bitrate, sending large pictures up to this many frames early (adds that much latency)\n"
+           "  -T  pace UDP in the kernel: hand whole pictures over with SO_TXTIME departure times (needs -p, -k or -a, and the fq qdisc)\n"
+           "  -b  run the benchmarks (start code scanners, indexing, smoothing, timing wheel, SO_TXTIME spacing and TCP sends on loopback, packet pool, io_uring vs sendmmsg, RTSP parser and responses) and exit\n",
+           prog);
+}
+
+// one event driven server per thread, sharded servers are pinned to a core each
+void serverThread(int worker, bool sharded)
+{
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (sharded && cores > 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker % cores, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            printf("worker %d: can't pin to core %d\n", worker, worker % cores);
+    }
+
+    RtspServerConfig config = serverConfig;
+    config.reusePort = sharded;
+    CRtspServer server(stream, stream_len, &nalIndex, config);
+    if (!server.Init())
+    {
+        printf("worker %d: can't start RTSP server\n", worker);
+        return;
+    }
+    printf("worker %d: running event driven RTSP server\n", worker);
+    server.Run();
+}
+
+int main(int argc, char **argv)
+{
+    bool forkMode = false;
+    bool bench = false;
+    int workers = 1;
+    initRtspServerConfig(&serverConfig);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+            forkMode = true;
+        else if (strcmp(argv[i], "-l") == 0)
+            serverConfig.live = true;
+        else if (strcmp(argv[i], "-G") == 0 && i + 1 < argc)
+            serverConfig.gopBurstSpeed = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            serverConfig.statsPeriodSec = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-g") == 0)
+            serverConfig.txFlags |= RTP_TX_UDP_GSO;
+        else if (strcmp(argv[i], "-c") == 0)
+            serverConfig.txFlags |= RTP_TX_UDP_CONNECTED;
+        else if (strcmp(argv[i], "-z") == 0)
+            serverConfig.txFlags |= RTP_TX_TCP_ZEROCOPY;
+        else if (strcmp(argv[i], "-U") == 0)
+            serverConfig.txFlags |= RTP_TX_IO_URING;
+        else if (strcmp(argv[i], "-H") == 0)
+            rtpPacketPoolInit(1);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            serverConfig.paceSpreadPercent = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+            serverConfig.paceKbps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            serverConfig.paceSmoothFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-T") == 0)
+            serverConfig.txFlags |= RTP_TX_UDP_TXTIME;
+        else if (strcmp(argv[i], "-b") == 0)
+            bench = true;
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        else
+            fileName = argv[i];
+    }
+
+    if ((serverConfig.txFlags & RTP_TX_UDP_TXTIME) && !serverConfig.paceSpreadPercent && !serverConfig.paceKbps &&
+        !serverConfig.paceSmoothFrames)
+    {
+        printf("-T paces in the kernel, it needs -p, -k or -a to know how\n");
+        usage(argv[0]);
+        return -1;
+    }
+
+    // a replay at real time or slower never catches up with the live stream
+    if (serverConfig.gopBurstSpeed && (serverConfig.gopBurstSpeed < 2 || !serverConfig.live || forkMode))
+    {
+        printf("-G needs -l (and no -f) and a speed of 2 or more\n");
+        usage(argv[0]);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN); // a dropped client must not take down the other sessions
+    srand(time(NULL) ^ getpid()); // session ids and SSRCs
+
+    if (!source.open(fileName))
+    {
+        printf("can't open %s.\n", fileName);
+        return -1;
+    }
+    stream = (uint8_t *)source.data();
+    stream_len = source.size();
+    if (!nalIndex.open(fileName, stream, stream_len))
+    {
+        printf("no NAL units in %s.\n", fileName);
+        return -1;
+    }
+
+    // clock the stream at the rate its VUI (or VPS) declares, default 30 without timing info
+    CH265ParamSets params;
+    if (params.scan(stream, nalIndex))
+    {
+        const H265StreamInfo &info = params.getInfo();
+        if (params.frameRate() >= 1)
+            serverConfig.fps = (int)(params.frameRate() + 0.5);
+        printf("%s: %ux%u, profile %d, level %d.%d, %.3f fps\n", fileName, info.width, info.height, info.profileId,
+               info.levelId / 30, info.levelId % 30 / 3, params.frameRate());
+    }
+    else
+        printf("%s: no SPS found, the SDP will have no parameter sets\n", fileName);
+
+    if (bench)
+    {
+        benchStartcodeScanners(stream, stream_len);
+        benchSmoothing(nalIndex, serverConfig.fps, serverConfig.paceSpreadPercent, serverConfig.paceSmoothFrames);
+        benchTimingWheel();
+        benchTxTimeSpacing();
+        benchTcpSend(stream, stream_len);
+        benchPacketPool();
+        benchIoUring(stream, stream_len);
+        benchRtspParser();
+        SimStreamer streamer(stream, stream_len, &nalIndex, serverConfig.fps);
+        benchRtspResponses(streamer);
+        return 0;
+    }
+
+    if (!forkMode)
+    {
+        if (workers <= 1)
+        {
+            serverThread(0, false);
+            return 0;
+        }
+
+        std::vector<std::thread> threads;
+        for (int w = 0; w < workers; ++w)
+            threads.push_back(std::thread(serverThread, w, true));
+        for (size_t w = 0; w < threads.size(); ++w)
+            threads[w].join();
+        return 0;
+    }
+
+    SOCKET MasterSocket;    // our masterSocket(socket that listens for RTSP client connections)
+    SOCKET ClientSocket;    // RTSP socket to handle an client
+    sockaddr_in ServerAddr; // server address parameters
+    sockaddr_in ClientAddr; // address parameters of a new RTSP client
+    socklen_t ClientAddrLen = sizeof(ClientAddr);
+
+    printf("running test RTSP server\n");
+
+    ServerAddr.sin_family = AF_INET;
+    ServerAddr.sin_addr.s_addr = INADDR_ANY;
+    ServerAddr.sin_port = htons(554); // listen on RTSP port 554
+    MasterSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+    int enable = 1;
+    if (setsockopt(MasterSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+    {
+        printf("setsockopt(SO_REUSEADDR) failed");
+        return 0;
+    }
+
+    // bind our master socket to the RTSP port and listen for a client connection
+    if (bind(MasterSocket, (sockaddr *)&ServerAddr, sizeof(ServerAddr)) != 0)
+    {
+        printf("error can't bind port errno=%d\n", errno);
+
+        return 0;
+    }
+
+    if (listen(MasterSocket, 5) != 0)
+        return 0;
+
+    while (true)
+    { // loop forever to accept client connections
+        ClientSocket = accept(MasterSocket, (struct sockaddr *)&ClientAddr, &ClientAddrLen);
+        printf("Client connected. Client address: %s\r\n", inet_ntoa(ClientAddr.sin_addr));
+        if (fork() == 0)
+        {
+            workerThread(ClientSocket);
+            break;
+        }
+    }
+    closesocket(MasterSocket);
+
+    return 0;
+}
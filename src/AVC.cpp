@@ -10,8 +10,17 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "AVC.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AVC_STARTCODE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define AVC_STARTCODE_NEON 1
+#endif
+
 static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p, const uint8_t *end)
 {
     const uint8_t *a = p + 4 - ((intptr_t)p & 3);  // The first address after a=p is 00
@@ -22,7 +31,8 @@ static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p, const uin
     }
 
     for (end -= 3; p < end; p += 4) {
-        uint32_t x = *(const uint32_t*)p;  // Get 4 bytes
+        uint32_t x;
+        memcpy(&x, p, sizeof(x));  // Get 4 bytes, p is aligned here but the compiler must not assume it
         if ((x - 0x01010101) & (~x) & 0x80808080) { // At least one byte in X is 0
             if (p[1] == 0) {
                 if (p[0] == 0 && p[2] == 1) // 0 0 1 x
@@ -47,8 +57,145 @@ static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p, const uin
     return end + 3; // no start code in [p, end], return end.
 }
 
-const uint8_t *ff_avc_find_startcode(const uint8_t *p, const uint8_t *end){
-    const uint8_t *out= ff_avc_find_startcode_internal(p, end);
+// bytes the vector loops leave over. Like the scalar code a start code in the
+// last 3 bytes is not reported, there is no NAL unit behind it anyway.
+static inline const uint8_t *find_startcode_tail(const uint8_t *p, const uint8_t *end)
+{
+    for (; p + 3 < end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+    return end;
+}
+
+#ifdef AVC_STARTCODE_X86
+// 16 positions per iteration: byte i, i+1 and i+2 are compared against 00 00 01 at once
+__attribute__((target("sse2")))
+static const uint8_t *find_startcode_sse2(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (; end - p >= 16 + 3; p += 16) {
+        __m128i z0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero);
+        __m128i z1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), zero);
+        __m128i o2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), one);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(z0, z1), o2));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_startcode_tail(p, end);
+}
+
+// same with 32 positions per iteration
+__attribute__((target("avx2")))
+static const uint8_t *find_startcode_avx2(const uint8_t *p, const uint8_t *end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    for (; end - p >= 32 + 3; p += 32) {
+        __m256i z0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), zero);
+        __m256i z1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), zero);
+        __m256i o2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)), one);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(z0, z1), o2));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_startcode_sse2(p, end);
+}
+#endif
+
+#ifdef AVC_STARTCODE_NEON
+// 16 positions per iteration, NEON has no movemask so a hit is located with the scalar compare
+static const uint8_t *find_startcode_neon(const uint8_t *p, const uint8_t *end)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    for (; end - p >= 16 + 3; p += 16) {
+        uint8x16_t z0 = vceqq_u8(vld1q_u8(p), zero);
+        uint8x16_t z1 = vceqq_u8(vld1q_u8(p + 1), zero);
+        uint8x16_t o2 = vceqq_u8(vld1q_u8(p + 2), one);
+        if (vmaxvq_u8(vandq_u8(vandq_u8(z0, z1), o2)))
+            return find_startcode_tail(p, p + 16 + 3);
+    }
+    return find_startcode_tail(p, end);
+}
+#endif
+
+// the ff_avc_find_startcode contract on top of a 00 00 01 finder
+static inline const uint8_t *startcode_fixup(const uint8_t *p, const uint8_t *out, const uint8_t *end)
+{
     if(p < out && out < end && !out[-1]) out--; // find 0001 in x001
     return out;
-}
\ No newline at end of file
+}
+
+static const uint8_t *avc_find_startcode_scalar(const uint8_t *p, const uint8_t *end)
+{
+    return startcode_fixup(p, ff_avc_find_startcode_internal(p, end), end);
+}
+
+#ifdef AVC_STARTCODE_X86
+static const uint8_t *avc_find_startcode_sse2(const uint8_t *p, const uint8_t *end)
+{
+    return startcode_fixup(p, find_startcode_sse2(p, end), end);
+}
+
+static const uint8_t *avc_find_startcode_avx2(const uint8_t *p, const uint8_t *end)
+{
+    return startcode_fixup(p, find_startcode_avx2(p, end), end);
+}
+#endif
+
+#ifdef AVC_STARTCODE_NEON
+static const uint8_t *avc_find_startcode_neon(const uint8_t *p, const uint8_t *end)
+{
+    return startcode_fixup(p, find_startcode_neon(p, end), end);
+}
+#endif
+
+static void add_scanner(StartcodeScannerInfo *list, int *n, int max, const char *name, StartcodeScanner find)
+{
+    if (*n < max) {
+        list[*n].name = name;
+        list[*n].find = find;
+        ++*n;
+    }
+}
+
+int avc_startcode_scanners(StartcodeScannerInfo *list, int max)
+{
+    int n = 0;
+    add_scanner(list, &n, max, "scalar", avc_find_startcode_scalar);
+#ifdef AVC_STARTCODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        add_scanner(list, &n, max, "sse2", avc_find_startcode_sse2);
+    if (__builtin_cpu_supports("avx2"))
+        add_scanner(list, &n, max, "avx2", avc_find_startcode_avx2);
+#endif
+#ifdef AVC_STARTCODE_NEON
+    add_scanner(list, &n, max, "neon", avc_find_startcode_neon);
+#endif
+    return n;
+}
+
+// the best scanner this CPU can run, picked once
+static const StartcodeScannerInfo &avc_best_startcode_scanner()
+{
+    static StartcodeScannerInfo best = []() {
+        StartcodeScannerInfo list[AVC_STARTCODE_SCANNERS_MAX];
+        return list[avc_startcode_scanners(list, AVC_STARTCODE_SCANNERS_MAX) - 1];
+    }();
+    return best;
+}
+
+const char *avc_startcode_scanner_name()
+{
+    return avc_best_startcode_scanner().name;
+}
+
+const uint8_t *ff_avc_find_startcode(const uint8_t *p, const uint8_t *end){
+    return avc_best_startcode_scanner().find(p, end);
+}
@@ -14,7 +14,23 @@
 
 #include <stdint.h>
 
-/* copied from FFmpeg libavformat/acv.c */
+/* copied from FFmpeg libavformat/acv.c, uses the fastest scanner of this CPU */
 const uint8_t *ff_avc_find_startcode(const uint8_t *p, const uint8_t *end);
 
+/* a start code finder with the ff_avc_find_startcode contract */
+typedef const uint8_t *(*StartcodeScanner)(const uint8_t *p, const uint8_t *end);
+
+typedef struct {
+    const char *name;
+    StartcodeScanner find;
+} StartcodeScannerInfo;
+
+#define AVC_STARTCODE_SCANNERS_MAX 4
+
+/* the scanners this CPU can run (scalar, sse2, avx2, neon), slowest first, returns their number */
+int avc_startcode_scanners(StartcodeScannerInfo *list, int max);
+
+/* name of the scanner ff_avc_find_startcode picked */
+const char *avc_startcode_scanner_name();
+
 #endif //RTPSERVER_AVC_H
@@ -0,0 +1,251 @@
+#include "CEventLoop.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#define EVENTLOOP_MAX_EVENTS 256
+
+CEventLoop::CEventLoop()
+{
+    m_Running = false;
+    m_Batch = NULL;
+    m_BatchNext = 0;
+    m_BatchSize = 0;
+    m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_EpollFd < 0)
+        printf("epoll_create1 failed errno=%d\n", errno);
+}
+
+CEventLoop::~CEventLoop()
+{
+    if (m_EpollFd >= 0)
+        close(m_EpollFd);
+}
+
+bool CEventLoop::add(int fd, uint32_t events, CEventHandler *handler)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        printf("epoll_ctl(ADD, %d) failed errno=%d\n", fd, errno);
+        return false;
+    }
+    return true;
+}
+
+bool CEventLoop::modify(int fd, uint32_t events, CEventHandler *handler)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, fd, &ev) != 0)
+    {
+        printf("epoll_ctl(MOD, %d) failed errno=%d\n", fd, errno);
+        return false;
+    }
+    return true;
+}
+
+void CEventLoop::remove(int fd, CEventHandler *handler)
+{
+    epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, fd, NULL);
+
+    // the handler may be deleted right after this, its events still to come in this batch must not reach it
+    for (int i = m_BatchNext; m_Batch && i < m_BatchSize; ++i)
+        if (m_Batch[i].data.ptr == handler)
+            m_Batch[i].data.ptr = NULL;
+}
+
+int CEventLoop::runOnce(int timeoutMs)
+{
+    epoll_event events[EVENTLOOP_MAX_EVENTS];
+
+    int n = epoll_wait(m_EpollFd, events, EVENTLOOP_MAX_EVENTS, timeoutMs);
+    if (n < 0)
+    {
+        if (errno != EINTR)
+            printf("epoll_wait failed errno=%d\n", errno);
+        return 0;
+    }
+
+    m_Batch = events;
+    m_BatchSize = n;
+    for (m_BatchNext = 0; m_BatchNext < n;)
+    {
+        epoll_event &ev = events[m_BatchNext++];
+        CEventHandler *handler = static_cast<CEventHandler *>(ev.data.ptr);
+        if (handler)
+            handler->onEvent(ev.events);
+    }
+    m_Batch = NULL;
+    return n;
+}
+
+void CEventLoop::run()
+{
+    m_Running = true;
+    while (m_Running)
+        runOnce(-1);
+}
+
+//===========================================================
+
+CPeriodicTimer::CPeriodicTimer()
+{
+    m_Loop = NULL;
+    m_TimerFd = -1;
+}
+
+CPeriodicTimer::~CPeriodicTimer()
+{
+    stop();
+}
+
+bool CPeriodicTimer::start(CEventLoop *loop, uint64_t periodNs)
+{
+    stop();
+
+    m_TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_TimerFd < 0)
+    {
+        printf("timerfd_create failed errno=%d\n", errno);
+        return false;
+    }
+
+    // the first expiry is an absolute deadline, the kernel derives all later ones from it,
+    // so however late we are served the ticks never drift
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t first = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec + periodNs;
+
+    itimerspec spec;
+    spec.it_interval.tv_sec = periodNs / 1000000000ULL;
+    spec.it_interval.tv_nsec = periodNs % 1000000000ULL;
+    spec.it_value.tv_sec = first / 1000000000ULL;
+    spec.it_value.tv_nsec = first % 1000000000ULL;
+    if (timerfd_settime(m_TimerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0 || !loop->add(m_TimerFd, EPOLLIN, this))
+    {
+        printf("can't arm media timer errno=%d\n", errno);
+        close(m_TimerFd);
+        m_TimerFd = -1;
+        return false;
+    }
+
+    m_Loop = loop;
+    return true;
+}
+
+void CPeriodicTimer::stop()
+{
+    if (m_TimerFd < 0)
+        return;
+
+    if (m_Loop)
+        m_Loop->remove(m_TimerFd, this);
+    close(m_TimerFd);
+    m_TimerFd = -1;
+    m_Loop = NULL;
+}
+
+void CPeriodicTimer::onEvent(uint32_t events)
+{
+    uint64_t expirations = 0;
+    if (read(m_TimerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return; // spurious wakeup
+
+    onTimer(expirations);
+}
+
+//===========================================================
+
+CDeadlineTimer::CDeadlineTimer()
+{
+    m_Loop = NULL;
+    m_TimerFd = -1;
+    m_Deadline = 0;
+}
+
+CDeadlineTimer::~CDeadlineTimer()
+{
+    close();
+}
+
+bool CDeadlineTimer::init(CEventLoop *loop)
+{
+    close();
+
+    m_TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_TimerFd < 0)
+    {
+        printf("timerfd_create failed errno=%d\n", errno);
+        return false;
+    }
+    if (!loop->add(m_TimerFd, EPOLLIN, this))
+    {
+        ::close(m_TimerFd);
+        m_TimerFd = -1;
+        return false;
+    }
+
+    m_Loop = loop;
+    return true;
+}
+
+void CDeadlineTimer::close()
+{
+    if (m_TimerFd < 0)
+        return;
+
+    m_Loop->remove(m_TimerFd, this);
+    ::close(m_TimerFd);
+    m_TimerFd = -1;
+    m_Loop = NULL;
+    m_Deadline = 0;
+}
+
+bool CDeadlineTimer::arm(uint64_t deadlineNs)
+{
+    if (m_TimerFd < 0)
+        return false;
+    if (deadlineNs == m_Deadline)
+        return true;
+
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadlineNs / 1000000000ULL;
+    spec.it_value.tv_nsec = deadlineNs % 1000000000ULL;
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1; // zero would disarm, a deadline in the past fires right away
+    if (timerfd_settime(m_TimerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+    {
+        printf("can't arm deadline timer errno=%d\n", errno);
+        return false;
+    }
+    m_Deadline = deadlineNs;
+    return true;
+}
+
+void CDeadlineTimer::disarm()
+{
+    if (m_TimerFd < 0 || !m_Deadline)
+        return;
+
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    timerfd_settime(m_TimerFd, 0, &spec, NULL);
+    m_Deadline = 0;
+}
+
+void CDeadlineTimer::onEvent(uint32_t events)
+{
+    uint64_t expirations = 0;
+    if (read(m_TimerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return; // spurious wakeup, or re-armed in the meantime
+
+    m_Deadline = 0;
+    onTimer();
+}
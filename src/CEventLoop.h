@@ -0,0 +1,98 @@
+#pragma once
+
+#include "platglue.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/**
+   Receiver of readiness notifications from a CEventLoop.
+ */
+class CEventHandler
+{
+public:
+    virtual ~CEventHandler() {}
+
+    /// called with the epoll event mask (EPOLLIN, EPOLLOUT, EPOLLHUP, ...) of the registered fd
+    virtual void onEvent(uint32_t events) = 0;
+};
+
+/**
+   Single threaded epoll reactor (posix only).
+
+   Every registered fd carries a CEventHandler that is called back from run()/runOnce().
+   Handlers may remove (and delete) themselves, or other handlers, from within onEvent():
+   remove() also drops the handler's events still waiting in the batch being dispatched.
+ */
+class CEventLoop
+{
+public:
+    CEventLoop();
+    ~CEventLoop();
+
+    bool isValid() { return m_EpollFd >= 0; }
+
+    bool add(int fd, uint32_t events, CEventHandler *handler);
+    bool modify(int fd, uint32_t events, CEventHandler *handler);
+    void remove(int fd, CEventHandler *handler);
+
+    /// wait up to timeoutMs (-1 = forever) and dispatch ready handlers, returns number of handled events
+    int runOnce(int timeoutMs);
+    void run();
+    void stop() { m_Running = false; }
+
+private:
+    int m_EpollFd;
+    bool m_Running;
+    epoll_event *m_Batch; // the events runOnce() dispatches, NULL outside of it
+    int m_BatchNext;      // index of the next one to dispatch
+    int m_BatchSize;
+};
+
+/**
+   Periodic timer based on timerfd, dispatched by a CEventLoop.
+ */
+class CPeriodicTimer : public CEventHandler
+{
+public:
+    CPeriodicTimer();
+    virtual ~CPeriodicTimer();
+
+    bool start(CEventLoop *loop, uint64_t periodNs);
+    void stop();
+
+    /// called once per expiration batch, expirations > 1 means we were late
+    virtual void onTimer(uint64_t expirations) = 0;
+
+    virtual void onEvent(uint32_t events);
+
+private:
+    CEventLoop *m_Loop;
+    int m_TimerFd;
+};
+
+/**
+   One shot timer on an absolute CLOCK_MONOTONIC deadline, based on timerfd, dispatched by a CEventLoop.
+ */
+class CDeadlineTimer : public CEventHandler
+{
+public:
+    CDeadlineTimer();
+    virtual ~CDeadlineTimer();
+
+    bool init(CEventLoop *loop);
+    void close();
+
+    /// fire once at deadlineNs, replaces an armed deadline
+    bool arm(uint64_t deadlineNs);
+    void disarm();
+    uint64_t getDeadline() { return m_Deadline; } // 0 = not armed
+
+    virtual void onTimer() = 0;
+
+    virtual void onEvent(uint32_t events);
+
+private:
+    CEventLoop *m_Loop;
+    int m_TimerFd;
+    uint64_t m_Deadline;
+};
@@ -0,0 +1,77 @@
+#include "CFileSource.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+CFileSource::CFileSource()
+{
+    m_Fd = -1;
+    m_Data = NULL;
+    m_Size = 0;
+}
+
+CFileSource::~CFileSource()
+{
+    close();
+}
+
+bool CFileSource::open(const char *file)
+{
+    close();
+
+    printf("mapping %s\n", file);
+    m_Fd = ::open(file, O_RDONLY | O_CLOEXEC);
+    if (m_Fd < 0)
+    {
+        printf("can't open %s errno=%d\n", file, errno);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(m_Fd, &info) != 0 || info.st_size <= 0)
+    {
+        printf("can't stat %s or file is empty\n", file);
+        close();
+        return false;
+    }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, m_Fd, 0);
+    if (data == MAP_FAILED)
+    {
+        printf("can't mmap %s errno=%d\n", file, errno);
+        close();
+        return false;
+    }
+    m_Data = (const uint8_t *)data;
+    m_Size = info.st_size;
+
+    // we stream front to back: aggressive readahead, and get the start in right away
+    madvise(data, (size_t)m_Size, MADV_SEQUENTIAL);
+    willNeed(m_Data, m_Size < FILESOURCE_READAHEAD ? (size_t)m_Size : FILESOURCE_READAHEAD);
+
+    printf("File Size = %lld Bytes\n", (long long)m_Size);
+    return true;
+}
+
+void CFileSource::close()
+{
+    if (m_Data)
+        munmap((void *)m_Data, (size_t)m_Size);
+    if (m_Fd >= 0)
+        ::close(m_Fd);
+
+    m_Fd = -1;
+    m_Data = NULL;
+    m_Size = 0;
+}
+
+void CFileSource::willNeed(const uint8_t *addr, size_t len)
+{
+    // madvise wants a page aligned start
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    madvise((void *)start, len + ((uintptr_t)addr - start), MADV_WILLNEED);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILESOURCE_READAHEAD (8 * 1024 * 1024) // bytes we ask the kernel to fetch ahead of the reader
+
+/**
+   Read only memory mapping of a media file.
+
+   The file is not copied: all sessions, threads and (forked) processes share the page cache,
+   pages are faulted in on first use, and the mapping does not count against our heap. The size
+   is 64 bit, so recordings larger than 2 GB work.
+ */
+class CFileSource
+{
+public:
+    CFileSource();
+    ~CFileSource();
+
+    bool open(const char *file);
+    void close();
+
+    const uint8_t *data() { return m_Data; }
+    int64_t size() { return m_Size; }
+
+    /// hint the kernel that [addr, addr + len) of a mapping will be read soon, the range must be mapped
+    static void willNeed(const uint8_t *addr, size_t len);
+
+private:
+    int m_Fd;
+    const uint8_t *m_Data;
+    int64_t m_Size;
+};
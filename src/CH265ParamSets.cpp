@@ -0,0 +1,399 @@
+#include "CH265ParamSets.h"
+#include <string.h>
+
+#define H265_RBSP_MAX 1024 // parameter sets are far smaller, what is beyond is not looked at
+
+/**
+   Bit reader over the RBSP of a NAL unit (emulation prevention bytes removed), with the
+   Exp-Golomb codes of H.265 7.2. Reading past the end yields zeros and sets m_Overrun.
+ */
+class RbspReader
+{
+public:
+    RbspReader(const uint8_t *nal, size_t len) : m_Len(0), m_Pos(0), m_Overrun(false)
+    {
+        int zeros = 0;
+        for (size_t i = 2; i < len && m_Len < H265_RBSP_MAX; ++i) // after the NAL unit header
+        {
+            if (zeros >= 2 && nal[i] == 3)
+            {
+                zeros = 0;
+                continue;
+            }
+            zeros = nal[i] ? 0 : zeros + 1;
+            m_Rbsp[m_Len++] = nal[i];
+        }
+    }
+
+    uint32_t u(int bits)
+    {
+        uint32_t v = 0;
+        for (int i = 0; i < bits; ++i)
+        {
+            if (m_Pos >= m_Len * 8)
+            {
+                m_Overrun = true;
+                return 0;
+            }
+            v = (v << 1) | ((m_Rbsp[m_Pos >> 3] >> (7 - (m_Pos & 7))) & 1);
+            ++m_Pos;
+        }
+        return v;
+    }
+
+    uint32_t ue()
+    {
+        int zeros = 0;
+        while (!u(1))
+        {
+            if (m_Overrun || ++zeros > 31)
+            {
+                m_Overrun = true;
+                return 0;
+            }
+        }
+        return ((1u << zeros) - 1) + u(zeros);
+    }
+
+    int32_t se()
+    {
+        uint32_t v = ue();
+        return v & 1 ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+    }
+
+    void skip(int bits) { u(bits); }
+    bool overrun() const { return m_Overrun; }
+
+private:
+    uint8_t m_Rbsp[H265_RBSP_MAX];
+    size_t m_Len;
+    size_t m_Pos; // in bits
+    bool m_Overrun;
+};
+
+// profile_tier_level(1, maxSubLayersMinus1), H.265 7.3.3
+static void parseProfileTierLevel(RbspReader &r, int maxSubLayersMinus1, H265StreamInfo *info)
+{
+    info->profileSpace = r.u(2);
+    info->tierFlag = r.u(1);
+    info->profileId = r.u(5);
+    r.skip(32); // general_profile_compatibility_flag[32]
+    r.skip(48); // progressive/interlaced/non packed/frame only and the constraint flags
+    info->levelId = r.u(8);
+
+    bool profilePresent[8], levelPresent[8];
+    for (int i = 0; i < maxSubLayersMinus1; ++i)
+    {
+        profilePresent[i] = r.u(1);
+        levelPresent[i] = r.u(1);
+    }
+    if (maxSubLayersMinus1 > 0)
+        for (int i = maxSubLayersMinus1; i < 8; ++i)
+            r.skip(2);
+    for (int i = 0; i < maxSubLayersMinus1; ++i)
+    {
+        if (profilePresent[i])
+            r.skip(88);
+        if (levelPresent[i])
+            r.skip(8);
+    }
+}
+
+// scaling_list_data(), 7.3.4
+static void skipScalingListData(RbspReader &r)
+{
+    for (int sizeId = 0; sizeId < 4; ++sizeId)
+    {
+        for (int matrixId = 0; matrixId < 6; matrixId += sizeId == 3 ? 3 : 1)
+        {
+            if (!r.u(1)) // scaling_list_pred_mode_flag
+            {
+                r.ue(); // scaling_list_pred_matrix_id_delta
+                continue;
+            }
+            int coefNum = 1 << (4 + (sizeId << 1));
+            if (coefNum > 64)
+                coefNum = 64;
+            if (sizeId > 1)
+                r.se(); // scaling_list_dc_coef_minus8
+            for (int i = 0; i < coefNum; ++i)
+                r.se(); // scaling_list_delta_coef
+        }
+    }
+}
+
+/*
+   st_ref_pic_set(idx) of an SPS, 7.3.7: only its size matters to us, but a set predicted from
+   the one before needs the number of delta POCs of that one (numDeltaPocs).
+ */
+static bool skipShortTermRefPicSet(RbspReader &r, unsigned idx, std::vector<unsigned> &numDeltaPocs)
+{
+    if (idx && r.u(1)) // inter_ref_pic_set_prediction_flag
+    {
+        r.skip(1); // delta_rps_sign
+        r.ue();    // abs_delta_rps_minus1
+        unsigned ref = idx - 1; // delta_idx_minus1 is only sent in slice headers
+        unsigned count = 0;
+        for (unsigned j = 0; j <= numDeltaPocs[ref]; ++j)
+        {
+            bool used = r.u(1);
+            if (used || r.u(1)) // use_delta_flag
+                ++count;
+        }
+        numDeltaPocs[idx] = count;
+        return !r.overrun();
+    }
+
+    unsigned negative = r.ue(), positive = r.ue();
+    if (negative > 16 || positive > 16)
+        return false;
+    for (unsigned i = 0; i < negative + positive; ++i)
+    {
+        r.ue();    // delta_poc_sx_minus1
+        r.skip(1); // used_by_curr_pic_sx_flag
+    }
+    numDeltaPocs[idx] = negative + positive;
+    return !r.overrun();
+}
+
+CH265ParamSets::CH265ParamSets()
+{
+    memset(&m_Info, 0, sizeof(m_Info));
+}
+
+/*
+   seq_parameter_set_rbsp(), 7.3.2.2, up to the timing info of its VUI (E.2.1)
+ */
+bool CH265ParamSets::parseSps(const uint8_t *nal, size_t len)
+{
+    H265StreamInfo info;
+    memset(&info, 0, sizeof(info));
+    RbspReader r(nal, len);
+
+    r.skip(4); // sps_video_parameter_set_id
+    int maxSubLayersMinus1 = r.u(3);
+    r.skip(1); // sps_temporal_id_nesting_flag
+    parseProfileTierLevel(r, maxSubLayersMinus1, &info);
+    r.ue(); // sps_seq_parameter_set_id
+
+    unsigned chromaFormatIdc = r.ue();
+    if (chromaFormatIdc == 3)
+        r.skip(1); // separate_colour_plane_flag
+    info.width = r.ue();
+    info.height = r.ue();
+    if (r.u(1)) // conformance_window_flag
+    {
+        unsigned subWidth = chromaFormatIdc == 1 || chromaFormatIdc == 2 ? 2 : 1;
+        unsigned subHeight = chromaFormatIdc == 1 ? 2 : 1;
+        unsigned left = r.ue(), right = r.ue(), top = r.ue(), bottom = r.ue();
+        info.width -= subWidth * (left + right);
+        info.height -= subHeight * (top + bottom);
+    }
+    r.ue(); // bit_depth_luma_minus8
+    r.ue(); // bit_depth_chroma_minus8
+    unsigned log2MaxPocLsb = r.ue() + 4;
+    bool orderingInfo = r.u(1);
+    for (int i = orderingInfo ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; ++i)
+    {
+        r.ue(); // sps_max_dec_pic_buffering_minus1
+        r.ue(); // sps_max_num_reorder_pics
+        r.ue(); // sps_max_latency_increase_plus1
+    }
+    for (int i = 0; i < 6; ++i)
+        r.ue(); // coding and transform block sizes, transform hierarchy depths
+    if (r.u(1) && r.u(1)) // scaling_list_enabled_flag, sps_scaling_list_data_present_flag
+        skipScalingListData(r);
+    r.skip(2); // amp_enabled_flag, sample_adaptive_offset_enabled_flag
+    if (r.u(1)) // pcm_enabled_flag
+    {
+        r.skip(8);
+        r.ue();
+        r.ue();
+        r.skip(1);
+    }
+
+    unsigned sets = r.ue(); // num_short_term_ref_pic_sets
+    if (sets > 64)
+        return false;
+    std::vector<unsigned> numDeltaPocs(sets);
+    for (unsigned i = 0; i < sets; ++i)
+        if (!skipShortTermRefPicSet(r, i, numDeltaPocs))
+            return false;
+
+    if (r.u(1)) // long_term_ref_pics_present_flag
+    {
+        unsigned count = r.ue();
+        if (count > 32)
+            return false;
+        for (unsigned i = 0; i < count; ++i)
+            r.skip(log2MaxPocLsb + 1); // lt_ref_pic_poc_lsb_sps, used_by_curr_pic_lt_sps_flag
+    }
+    r.skip(2); // sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+
+    if (r.u(1)) // vui_parameters_present_flag
+    {
+        if (r.u(1) && r.u(8) == 255) // aspect_ratio_info_present_flag, aspect_ratio_idc == EXTENDED_SAR
+            r.skip(32);
+        if (r.u(1)) // overscan_info_present_flag
+            r.skip(1);
+        if (r.u(1)) // video_signal_type_present_flag
+        {
+            r.skip(4);
+            if (r.u(1)) // colour_description_present_flag
+                r.skip(24);
+        }
+        if (r.u(1)) // chroma_loc_info_present_flag
+        {
+            r.ue();
+            r.ue();
+        }
+        r.skip(3); // neutral_chroma_indication_flag, field_seq_flag, frame_field_info_present_flag
+        if (r.u(1)) // default_display_window_flag
+            for (int i = 0; i < 4; ++i)
+                r.ue();
+        if (r.u(1)) // vui_timing_info_present_flag
+        {
+            info.numUnitsInTick = r.u(32);
+            info.timeScale = r.u(32);
+        }
+    }
+
+    if (r.overrun() || !info.width || !info.height)
+        return false;
+    // the VPS may have timing info the SPS lacks
+    if (!info.numUnitsInTick)
+    {
+        info.numUnitsInTick = m_Info.numUnitsInTick;
+        info.timeScale = m_Info.timeScale;
+    }
+    m_Info = info;
+    return true;
+}
+
+/*
+   video_parameter_set_rbsp(), 7.3.2.1, up to vps_timing_info
+ */
+bool CH265ParamSets::parseVpsTiming(const uint8_t *nal, size_t len)
+{
+    H265StreamInfo info;
+    RbspReader r(nal, len);
+    r.skip(4 + 1 + 1 + 6); // vps_video_parameter_set_id, base layer flags, vps_max_layers_minus1
+    int maxSubLayersMinus1 = r.u(3);
+    r.skip(1 + 16); // vps_temporal_id_nesting_flag, vps_reserved_0xffff_16bits
+    parseProfileTierLevel(r, maxSubLayersMinus1, &info);
+    bool orderingInfo = r.u(1);
+    for (int i = orderingInfo ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; ++i)
+    {
+        r.ue();
+        r.ue();
+        r.ue();
+    }
+    unsigned maxLayerId = r.u(6);
+    unsigned layerSets = r.ue(); // vps_num_layer_sets_minus1
+    if (layerSets > 1023)
+        return false;
+    for (unsigned i = 1; i <= layerSets; ++i)
+        r.skip(maxLayerId + 1);
+    if (!r.u(1)) // vps_timing_info_present_flag
+        return false;
+    uint32_t numUnitsInTick = r.u(32), timeScale = r.u(32);
+    if (r.overrun() || !numUnitsInTick || !timeScale)
+        return false;
+    if (!m_Info.numUnitsInTick) // the SPS VUI wins
+    {
+        m_Info.numUnitsInTick = numUnitsInTick;
+        m_Info.timeScale = timeScale;
+    }
+    return true;
+}
+
+bool CH265ParamSets::update(const uint8_t *nal, size_t len)
+{
+    if (len < 3)
+        return false;
+
+    int type = (nal[0] >> 1) & 0x3f;
+    std::vector<uint8_t> *set = type == H265_NAL_VPS ? &m_Vps : type == H265_NAL_SPS ? &m_Sps : type == H265_NAL_PPS ? &m_Pps : NULL;
+    if (!set || (set->size() == len && memcmp(set->data(), nal, len) == 0))
+        return false;
+
+    if (type == H265_NAL_SPS && !parseSps(nal, len))
+    {
+        printf("can't parse the SPS, keeping the previous one\n");
+        return false;
+    }
+    if (type == H265_NAL_VPS)
+        parseVpsTiming(nal, len);
+    set->assign(nal, nal + len);
+    return true;
+}
+
+bool CH265ParamSets::scan(const uint8_t *stream, const CNalIndex &index)
+{
+    // the sets in front of the first picture
+    for (size_t i = 0; i < index.count() && !(hasSps() && !m_Pps.empty() && !m_Vps.empty()); ++i)
+    {
+        const NalIndexEntry &e = index.entry(i);
+        if (e.type < 32 && hasSps())
+            break;
+        update(stream + e.offset, e.length);
+    }
+    return hasSps();
+}
+
+double CH265ParamSets::frameRate() const
+{
+    if (!m_Info.numUnitsInTick || !m_Info.timeScale)
+        return 0;
+    return (double)m_Info.timeScale / m_Info.numUnitsInTick;
+}
+
+static void appendBase64(String &out, const std::vector<uint8_t> &data)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3)
+    {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out += alphabet[v >> 18];
+        out += alphabet[(v >> 12) & 63];
+        out += alphabet[(v >> 6) & 63];
+        out += alphabet[v & 63];
+    }
+    if (i < data.size())
+    {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < data.size())
+            v |= data[i + 1] << 8;
+        out += alphabet[v >> 18];
+        out += alphabet[(v >> 12) & 63];
+        out += i + 1 < data.size() ? alphabet[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+}
+
+String CH265ParamSets::fmtp() const
+{
+    char params[96];
+    String out;
+    if (m_Info.profileSpace)
+    {
+        snprintf(params, sizeof(params), "profile-space=%d;", m_Info.profileSpace);
+        out += params;
+    }
+    if (m_Info.tierFlag)
+        out += "tier-flag=1;";
+    snprintf(params, sizeof(params), "profile-id=%d;level-id=%d", m_Info.profileId, m_Info.levelId);
+    out += params;
+
+    const std::vector<uint8_t> *sets[3] = {&m_Vps, &m_Sps, &m_Pps};
+    static const char *const names[3] = {";sprop-vps=", ";sprop-sps=", ";sprop-pps="};
+    for (int i = 0; i < 3; ++i)
+    {
+        if (sets[i]->empty())
+            continue;
+        out += names[i];
+        appendBase64(out, *sets[i]);
+    }
+    return out;
+}
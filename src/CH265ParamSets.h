@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CNalIndex.h"
+#include "platglue.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define H265_NAL_VPS 32
+#define H265_NAL_SPS 33
+#define H265_NAL_PPS 34
+
+// what the SPS (and VPS) tell about a stream
+struct H265StreamInfo
+{
+    unsigned width, height;  // cropped to the conformance window
+    int profileSpace;
+    int tierFlag;
+    int profileId;           // general_profile_idc, 1 = Main
+    int levelId;             // general_level_idc, 30 times the level
+    uint32_t numUnitsInTick; // frame duration in timeScale units, 0 = no timing info
+    uint32_t timeScale;
+};
+
+/**
+   The current VPS, SPS and PPS of an H.265 stream, with what the SPS says about the pictures
+   (size, profile, tier, level and the frame rate of its VUI, or of the VPS timing info).
+
+   Feed every parameter set NAL unit to update(): it tells whether one changed, so a cached
+   session description only needs to be rebuilt then. fmtp() gives the RFC 7798 format
+   parameters with the sets as sprop-vps/sps/pps, so decoders can start on the first IRAP
+   without waiting for in-band sets.
+ */
+class CH265ParamSets
+{
+public:
+    CH265ParamSets();
+
+    /// the first parameter sets of an indexed stream, false if it has no SPS
+    bool scan(const uint8_t *stream, const CNalIndex &index);
+    /// take a VPS, SPS or PPS NAL unit (header included, no start code), true if it differs from the one we had
+    bool update(const uint8_t *nal, size_t len);
+
+    bool hasSps() const { return !m_Sps.empty(); }
+    const H265StreamInfo &getInfo() const { return m_Info; }
+    double frameRate() const; // 0 if the stream has no timing info
+    /// "profile-id=1;level-id=93;sprop-vps=...;sprop-sps=...;sprop-pps=..."
+    String fmtp() const;
+
+private:
+    bool parseSps(const uint8_t *nal, size_t len);
+    bool parseVpsTiming(const uint8_t *nal, size_t len);
+
+    std::vector<uint8_t> m_Vps, m_Sps, m_Pps;
+    H265StreamInfo m_Info;
+};
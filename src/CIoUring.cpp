@@ -0,0 +1,350 @@
+#include "CIoUring.h"
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef RTP_HAVE_IO_URING
+#include <linux/io_uring.h>
+
+// one UDP packet in flight
+struct CIoUring::UdpSend : public CIoUringOp
+{
+    CIoUring *ring;
+    UdpSend *nextFree;
+    RtpPacket *pkt;
+    uint8_t hdr[RTP_HEADER_SIZE];
+    sockaddr_in dest;
+    iovec iov[1 + RTP_PACKET_MAX_CHUNKS];
+    msghdr msg;
+    char control[UDP_TXTIME_CONTROL_SIZE];
+
+    virtual void onComplete(int res)
+    {
+        if (res < 0) // -ECANCELED: a send linked before it failed
+        {
+            if (res == -EINVAL && !ring->m_Broken)
+            {
+                printf("io_uring can't send (kernel too old?), back to sendmmsg\n");
+                ring->m_Broken = true;
+            }
+            ++ring->m_Failed;
+            ring->m_FailedBytes += pkt->len;
+        }
+        rtpPacketUnref(pkt);
+        pkt = NULL;
+        nextFree = ring->m_FreeUdp;
+        ring->m_FreeUdp = this;
+        ++ring->m_FreeUdpCount;
+    }
+};
+
+CIoUring::CIoUring()
+{
+    m_Fd = -1;
+    m_Loop = NULL;
+    m_Broken = false;
+    m_RingMap = MAP_FAILED;
+    m_RingSize = 0;
+    m_Sqes = (io_uring_sqe *)MAP_FAILED;
+    m_SqesSize = 0;
+    m_SqLocalTail = 0;
+    m_SqSubmitted = 0;
+    m_Linked = NULL;
+    m_UdpSends = NULL;
+    m_UdpCount = 0;
+    m_FreeUdp = NULL;
+    m_FreeUdpCount = 0;
+    m_Failed = 0;
+    m_FailedBytes = 0;
+    m_Enters = 0;
+}
+
+CIoUring::~CIoUring()
+{
+    if (m_Fd >= 0)
+    {
+        // the kernel may still read our slots
+        submit();
+        while (m_UdpSends)
+        {
+            bool pending = false;
+            for (unsigned i = 0; i < m_UdpCount && !pending; ++i)
+                pending = m_UdpSends[i].isPending();
+            if (!pending || enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+                break;
+            reap();
+        }
+        if (m_Loop)
+            m_Loop->remove(m_Fd, this);
+        close(m_Fd);
+    }
+    if (m_Sqes != MAP_FAILED)
+        munmap(m_Sqes, m_SqesSize);
+    if (m_RingMap != MAP_FAILED)
+        munmap(m_RingMap, m_RingSize);
+    delete[] m_UdpSends;
+}
+
+bool CIoUring::init(CEventLoop *loop, unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_Fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (m_Fd < 0)
+    {
+        printf("io_uring not available (errno=%d), using sendmmsg\n", errno);
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+    {
+        printf("io_uring too old (features 0x%x), using sendmmsg\n", params.features);
+        close(m_Fd);
+        m_Fd = -1;
+        return false;
+    }
+
+    // SQ and CQ ring share one mapping, the SQEs have their own
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_RingSize = sqSize > cqSize ? sqSize : cqSize;
+    m_RingMap = mmap(NULL, m_RingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+    m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_Sqes = (io_uring_sqe *)mmap(NULL, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES);
+    if (m_RingMap == MAP_FAILED || m_Sqes == MAP_FAILED)
+    {
+        printf("can't map io_uring errno=%d, using sendmmsg\n", errno);
+        close(m_Fd);
+        m_Fd = -1;
+        return false;
+    }
+
+    uint8_t *ring = (uint8_t *)m_RingMap;
+    m_SqHead = (unsigned *)(ring + params.sq_off.head);
+    m_SqTail = (unsigned *)(ring + params.sq_off.tail);
+    m_SqMask = (unsigned *)(ring + params.sq_off.ring_mask);
+    m_SqArray = (unsigned *)(ring + params.sq_off.array);
+    m_SqEntries = params.sq_entries;
+    m_SqLocalTail = m_SqSubmitted = *m_SqTail;
+    m_CqHead = (unsigned *)(ring + params.cq_off.head);
+    m_CqTail = (unsigned *)(ring + params.cq_off.tail);
+    m_CqMask = (unsigned *)(ring + params.cq_off.ring_mask);
+    m_Cqes = (io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // never more UDP sends in flight than completions fit
+    m_UdpCount = params.cq_entries;
+    m_UdpSends = new UdpSend[m_UdpCount];
+    for (unsigned i = 0; i < m_UdpCount; ++i)
+    {
+        m_UdpSends[i].ring = this;
+        m_UdpSends[i].pkt = NULL;
+        m_UdpSends[i].nextFree = m_FreeUdp;
+        m_FreeUdp = &m_UdpSends[i];
+    }
+    m_FreeUdpCount = m_UdpCount;
+
+    if (loop && !loop->add(m_Fd, EPOLLIN, this))
+        return false;
+    m_Loop = loop;
+    return true;
+}
+
+int CIoUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    ++m_Enters;
+    int res;
+    do
+        res = (int)syscall(__NR_io_uring_enter, m_Fd, toSubmit, minComplete, flags, NULL, 0);
+    while (res < 0 && errno == EINTR);
+    return res;
+}
+
+// the next free SQE, NULL if the submission queue is full
+io_uring_sqe *CIoUring::getSqe()
+{
+    unsigned head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+    if (m_SqLocalTail - head >= m_SqEntries)
+        return NULL;
+
+    unsigned index = m_SqLocalTail & *m_SqMask;
+    io_uring_sqe *sqe = &m_Sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_SqArray[index] = index;
+    ++m_SqLocalTail;
+    return sqe;
+}
+
+bool CIoUring::reserve(unsigned count)
+{
+    if (count > m_SqEntries || count > m_UdpCount)
+        return false; // never fits
+
+    // only whole chains are queued here, submitting them breaks none
+    unsigned head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+    if (m_SqEntries - (m_SqLocalTail - head) < count || m_FreeUdpCount < count)
+        submit();
+    while (m_FreeUdpCount < count && enter(0, 1, IORING_ENTER_GETEVENTS) >= 0)
+        reap();
+
+    head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+    return m_SqEntries - (m_SqLocalTail - head) >= count && m_FreeUdpCount >= count;
+}
+
+// the chain being queued ends with the send before the one that failed
+void CIoUring::endChain()
+{
+    if (m_Linked)
+        m_Linked->flags &= ~IOSQE_IO_LINK;
+    m_Linked = NULL;
+}
+
+bool CIoUring::sendmsg(int fd, const msghdr *msg, int flags, CIoUringOp *op, bool link)
+{
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe && !m_Linked)
+    {
+        // full: send what we have, the completions make room
+        submit();
+        sqe = getSqe();
+    }
+    if (!sqe)
+    {
+        endChain();
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    op->m_Pending = true;
+    m_Linked = link ? sqe : NULL;
+    return true;
+}
+
+bool CIoUring::sendUdp(int fd, const sockaddr_in *dest, RtpPacket *pkt, const uint8_t *hdr, uint64_t txtimeNs, bool link)
+{
+    if (!m_FreeUdp && !m_Linked)
+    {
+        submit();
+        if (!m_FreeUdp)
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+        reap();
+    }
+    if (!m_FreeUdp)
+    {
+        endChain();
+        return false;
+    }
+    UdpSend *send = m_FreeUdp;
+    m_FreeUdp = send->nextFree;
+    --m_FreeUdpCount;
+
+    send->pkt = rtpPacketRef(pkt);
+    memcpy(send->hdr, hdr, RTP_HEADER_SIZE);
+    send->iov[0].iov_base = send->hdr;
+    send->iov[0].iov_len = RTP_HEADER_SIZE;
+    memcpy(&send->iov[1], pkt->chunk, pkt->chunks * sizeof(iovec));
+    memset(&send->msg, 0, sizeof(send->msg));
+    if (dest)
+    {
+        send->dest = *dest;
+        send->msg.msg_name = &send->dest;
+        send->msg.msg_namelen = sizeof(send->dest);
+    }
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = 1 + pkt->chunks;
+    if (txtimeNs)
+        udpmsgsettxtime(&send->msg, send->control, txtimeNs);
+
+    if (!sendmsg(fd, &send->msg, 0, send, link))
+    {
+        send->onComplete(-ECANCELED);
+        return false;
+    }
+    return true;
+}
+
+void CIoUring::submit()
+{
+    endChain(); // a chain left open would link onto the next submit's first send
+    unsigned toSubmit = m_SqLocalTail - m_SqSubmitted;
+    if (toSubmit)
+    {
+        __atomic_store_n(m_SqTail, m_SqLocalTail, __ATOMIC_RELEASE);
+        m_SqSubmitted = m_SqLocalTail;
+        if (enter(toSubmit, 0, 0) < 0)
+            printf("io_uring_enter failed errno=%d\n", errno);
+    }
+    reap();
+}
+
+size_t CIoUring::reap()
+{
+    size_t reaped = 0;
+    for (;;)
+    {
+        unsigned head = *m_CqHead;
+        if (head == __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE))
+            break;
+
+        io_uring_cqe *cqe = &m_Cqes[head & *m_CqMask];
+        CIoUringOp *op = (CIoUringOp *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE); // before the callback, it may submit and reap again
+        op->m_Pending = false;
+        op->onComplete(res);
+        ++reaped;
+    }
+    return reaped;
+}
+
+void CIoUring::wait(CIoUringOp *op)
+{
+    submit();
+    while (op->isPending() && enter(0, 1, IORING_ENTER_GETEVENTS) >= 0)
+        reap();
+}
+
+void CIoUring::onEvent(uint32_t events)
+{
+    reap();
+}
+
+#else // no io_uring headers
+
+struct CIoUring::UdpSend
+{
+};
+
+CIoUring::CIoUring()
+{
+    m_Fd = -1;
+    m_Loop = NULL;
+    m_Broken = true;
+    m_UdpSends = NULL;
+    m_UdpCount = 0;
+    m_Failed = 0;
+    m_FailedBytes = 0;
+    m_Enters = 0;
+}
+
+CIoUring::~CIoUring() {}
+
+bool CIoUring::init(CEventLoop *loop, unsigned entries)
+{
+    printf("built without io_uring, using sendmmsg\n");
+    return false;
+}
+
+bool CIoUring::reserve(unsigned count) { return false; }
+bool CIoUring::sendmsg(int fd, const msghdr *msg, int flags, CIoUringOp *op, bool link) { return false; }
+bool CIoUring::sendUdp(int fd, const sockaddr_in *dest, RtpPacket *pkt, const uint8_t *hdr, uint64_t txtimeNs, bool link) { return false; }
+void CIoUring::submit() {}
+size_t CIoUring::reap() { return 0; }
+void CIoUring::wait(CIoUringOp *op) {}
+void CIoUring::onEvent(uint32_t events) {}
+
+#endif
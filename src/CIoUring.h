@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CEventLoop.h"
+#include "RtpPacket.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define RTP_HAVE_IO_URING 1
+#endif
+#endif
+
+#define IOURING_ENTRIES 1024 // submission queue size, the completion queue is twice that
+
+/**
+   A send in flight on a CIoUring, told its result (bytes or -errno) once the kernel is done with it.
+ */
+class CIoUringOp
+{
+public:
+    CIoUringOp() : m_Pending(false) {}
+    virtual ~CIoUringOp() {}
+
+    bool isPending() const { return m_Pending; }
+    virtual void onComplete(int res) = 0;
+
+private:
+    friend class CIoUring;
+    bool m_Pending;
+};
+
+/**
+   io_uring transmit backend: sends are queued as SQEs and handed to the kernel with one
+   io_uring_enter per frame for all viewers, instead of one sendmmsg/sendmsg per viewer.
+
+   Talks to the kernel directly (io_uring_setup/io_uring_enter and the mapped rings), no
+   liburing needed. Available if the headers have io_uring at compile time and the kernel
+   lets us set up a ring at runtime; otherwise init() fails and the callers stay on the
+   synchronous send path.
+
+   UDP packets get a slot of ours holding their header, msghdr and a packet reference until
+   the completion, so the sends of an access unit to one viewer can be linked (IOSQE_IO_LINK)
+   and go out in order. Such a chain is reserve()d whole before its first send is queued, so it is
+   never submitted half way; a send that fails anyway ends the chain at the one before it, so it
+   never links onto whatever is queued next. Completions are reaped right after submitting (socket sends mostly
+   complete inline) and, for the rest, when the ring fd turns readable in the event loop.
+ */
+class CIoUring : public CEventHandler
+{
+public:
+    CIoUring();
+    virtual ~CIoUring();
+
+    /// set up the ring, watched by loop (if any) for late completions; false if io_uring is not available
+    bool init(CEventLoop *loop, unsigned entries = IOURING_ENTRIES);
+    bool isValid() const { return m_Fd >= 0 && !m_Broken; }
+
+    /// make room for a chain of count UDP sends (SQEs and slots), false if the ring can't take them now
+    bool reserve(unsigned count);
+    /// queue a sendmsg; msg and everything it points to must stay valid until op completes
+    bool sendmsg(int fd, const msghdr *msg, int flags, CIoUringOp *op, bool link = false);
+    /// queue one RTP packet (RTP header hdr + the packet's payload) to a UDP socket, dest NULL if connected.
+    /// txtimeNs adds an SO_TXTIME departure time, link chains it to the next send
+    bool sendUdp(int fd, const sockaddr_in *dest, RtpPacket *pkt, const uint8_t *hdr, uint64_t txtimeNs, bool link);
+
+    /// hand the queued sends to the kernel (one io_uring_enter) and reap what completed
+    void submit();
+    /// run the completions that arrived
+    size_t reap();
+    /// block until op completed
+    void wait(CIoUringOp *op);
+
+    uint64_t getFailed() const { return m_Failed; } // UDP sends that completed with an error
+    uint64_t getFailedBytes() const { return m_FailedBytes; } // their RTP bytes
+    uint64_t getEnters() const { return m_Enters; } // io_uring_enter calls so far
+
+    virtual void onEvent(uint32_t events); // ring fd readable: completions arrived
+
+private:
+    struct UdpSend;
+
+    struct io_uring_sqe *getSqe();
+    void endChain();
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+
+    int m_Fd;
+    CEventLoop *m_Loop;
+    bool m_Broken; // the kernel refused our sends, back to the synchronous path
+
+    // mapped rings
+    void *m_RingMap;
+    size_t m_RingSize;
+    struct io_uring_sqe *m_Sqes;
+    size_t m_SqesSize;
+    unsigned *m_SqHead, *m_SqTail, *m_SqMask, *m_SqArray;
+    unsigned m_SqEntries;
+    unsigned m_SqLocalTail; // queued, not yet published to the kernel
+    unsigned m_SqSubmitted; // published
+    struct io_uring_sqe *m_Linked; // the last SQE queued, if it links to the next one
+    unsigned *m_CqHead, *m_CqTail, *m_CqMask;
+    struct io_uring_cqe *m_Cqes;
+
+    UdpSend *m_UdpSends; // slots, as many as the completion queue holds
+    unsigned m_UdpCount;
+    UdpSend *m_FreeUdp;
+    unsigned m_FreeUdpCount;
+    uint64_t m_Failed;
+    uint64_t m_FailedBytes;
+    uint64_t m_Enters;
+};
@@ -0,0 +1,310 @@
+#include "CNalIndex.h"
+#include "AVC.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <thread>
+#include <time.h>
+
+static const char nalIndexMagic[8] = {'H', 'E', 'V', 'C', 'N', 'I', 'D', 'X'};
+
+CNalIndex::CNalIndex()
+{
+    m_Entries = NULL;
+    m_Count = 0;
+    m_MaxTid = 0;
+    m_Map = NULL;
+    m_MapSize = 0;
+}
+
+CNalIndex::~CNalIndex()
+{
+    close();
+}
+
+void CNalIndex::close()
+{
+    if (m_Map)
+        munmap(m_Map, m_MapSize);
+    m_Map = NULL;
+    m_MapSize = 0;
+    m_Built.clear();
+    m_Entries = NULL;
+    m_Count = 0;
+    m_AuNals.clear();
+    m_AuBytes.clear();
+    m_MaxTid = 0;
+}
+
+bool CNalIndex::open(const char *file, const uint8_t *data, int64_t size)
+{
+    close();
+
+    struct stat info;
+    if (stat(file, &info) != 0)
+    {
+        printf("can't stat %s errno=%d\n", file, errno);
+        return false;
+    }
+    int64_t mtimeNs = (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+
+    std::string sidecar = std::string(file) + NALINDEX_SUFFIX;
+    if (load(sidecar.c_str(), (uint64_t)size, mtimeNs))
+    {
+        indexAccessUnits();
+        printf("NAL index: %zu NAL units, %zu access units, loaded from %s\n", m_Count, accessUnits(), sidecar.c_str());
+        return true;
+    }
+
+    timespec start, done;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    build(data, size, m_Built);
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    m_Entries = m_Built.data();
+    m_Count = m_Built.size();
+    indexAccessUnits();
+    printf("NAL index: %zu NAL units, %zu access units, built in %lld ms\n", m_Count, accessUnits(),
+           (long long)((done.tv_sec - start.tv_sec) * 1000 + (done.tv_nsec - start.tv_nsec) / 1000000));
+
+    if (!store(sidecar.c_str(), (uint64_t)size, mtimeNs))
+        printf("can't write %s, keeping the NAL index in memory\n", sidecar.c_str());
+    return m_Count > 0;
+}
+
+/**
+   Whether the entries of a sidecar can be served from a file of sourceSize bytes: each NAL unit
+   has its header and lies inside the file, behind the one before it. A sidecar is trusted no more
+   than the media file, one that lies about it is rebuilt instead of read out of bounds.
+ */
+static bool validEntries(const NalIndexEntry *entries, size_t count, uint64_t sourceSize)
+{
+    uint64_t end = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const NalIndexEntry &e = entries[i];
+        if (e.offset < end || e.offset > sourceSize || e.length < 2 || e.length > sourceSize - e.offset || e.type > 63)
+            return false;
+        end = e.offset + e.length;
+    }
+    return true;
+}
+
+bool CNalIndex::load(const char *sidecar, uint64_t sourceSize, int64_t sourceMtimeNs)
+{
+    int fd = ::open(sidecar, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(NalIndexHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    // the count comes from the file: compare it by division, its product may overflow. A NAL unit
+    // takes at least a 3 byte start code and its 2 byte header of the source
+    const NalIndexHeader *hdr = (const NalIndexHeader *)map;
+    size_t entryBytes = (size_t)info.st_size - sizeof(NalIndexHeader);
+    if (memcmp(hdr->magic, nalIndexMagic, sizeof(nalIndexMagic)) != 0 || hdr->version != NALINDEX_VERSION ||
+        hdr->entrySize != sizeof(NalIndexEntry) || hdr->sourceSize != sourceSize || hdr->sourceMtimeNs != sourceMtimeNs ||
+        entryBytes % sizeof(NalIndexEntry) != 0 || hdr->count != entryBytes / sizeof(NalIndexEntry) || hdr->count > sourceSize / 5)
+    {
+        printf("%s is stale, rebuilding the NAL index\n", sidecar);
+        munmap(map, (size_t)info.st_size);
+        return false;
+    }
+    if (!validEntries((const NalIndexEntry *)(hdr + 1), (size_t)hdr->count, sourceSize))
+    {
+        printf("%s is corrupt, rebuilding the NAL index\n", sidecar);
+        munmap(map, (size_t)info.st_size);
+        return false;
+    }
+
+    m_Map = map;
+    m_MapSize = (size_t)info.st_size;
+    m_Entries = (const NalIndexEntry *)(hdr + 1);
+    m_Count = (size_t)hdr->count;
+    return m_Count > 0;
+}
+
+bool CNalIndex::store(const char *sidecar, uint64_t sourceSize, int64_t sourceMtimeNs)
+{
+    // write a temporary file and rename it, so concurrent servers never see half an index
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%d", sidecar, (int)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp)
+        return false;
+
+    NalIndexHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, nalIndexMagic, sizeof(nalIndexMagic));
+    hdr.version = NALINDEX_VERSION;
+    hdr.entrySize = sizeof(NalIndexEntry);
+    hdr.count = m_Count;
+    hdr.sourceSize = sourceSize;
+    hdr.sourceMtimeNs = sourceMtimeNs;
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              (m_Count == 0 || fwrite(m_Entries, sizeof(NalIndexEntry), m_Count, fp) == m_Count);
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp, sidecar) != 0)
+    {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+void CNalIndex::indexAccessUnits()
+{
+    m_AuNals.clear();
+    m_AuBytes.clear();
+    m_MaxTid = 0;
+    for (size_t i = 0; i < m_Count; ++i)
+    {
+        if (m_Entries[i].type < 32 && m_Entries[i].tid > m_MaxTid)
+            m_MaxTid = m_Entries[i].tid; // VCL NAL units only
+        if ((m_Entries[i].flags & NAL_FLAG_AU_START) || m_AuNals.empty())
+        {
+            m_AuNals.push_back(i);
+            m_AuBytes.push_back(0);
+        }
+        m_AuBytes.back() += m_Entries[i].length;
+    }
+}
+
+// NAL units that, following a picture, start the next access unit (H.265 7.4.2.4.4)
+static bool startsAccessUnit(uint8_t type)
+{
+    return (type >= 32 && type <= 35) || // VPS, SPS, PPS, AUD
+           type == 39 ||                 // prefix SEI
+           (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+}
+
+// run fn(begin, end) over [0, n) split into threads slices, the calling thread takes the first slice
+template <typename Fn>
+static void parallelFor(int threads, size_t n, Fn fn)
+{
+    std::vector<std::thread> workers;
+    size_t slice = (n + threads - 1) / threads;
+    for (int t = 1; t < threads && t * slice < n; ++t)
+    {
+        size_t begin = t * slice;
+        size_t end = begin + slice < n ? begin + slice : n;
+        workers.push_back(std::thread(fn, begin, end));
+    }
+    fn(0, slice < n ? slice : n);
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+}
+
+/**
+   Collect the NAL unit starts (the byte behind 00 00 01) of all start codes that begin in
+   [from, to). The scan runs 3 bytes into the next chunk, so start codes straddling the
+   boundary are found by exactly one chunk: the one they begin in.
+ */
+static void scanChunk(const uint8_t *data, int64_t size, int64_t from, int64_t to, std::vector<uint64_t> &starts)
+{
+    const uint8_t *limit = data + (to + 3 < size ? to + 3 : size);
+    const uint8_t *r = ff_avc_find_startcode(data + from, limit);
+
+    while (r < limit)
+    {
+        while (!*r)
+            ++r;
+        ++r; // skip the 01 of the start code, 3 or 4 byte ones alike
+        starts.push_back((uint64_t)(r - data));
+        r = ff_avc_find_startcode(r, limit);
+    }
+}
+
+void CNalIndex::build(const uint8_t *data, int64_t size, std::vector<NalIndexEntry> &entries, int threads)
+{
+    entries.clear();
+    if (threads <= 0) // one per core, but don't bother for small files
+    {
+        threads = (int)std::thread::hardware_concurrency();
+        if (threads > size / NALINDEX_CHUNK_MIN)
+            threads = (int)(size / NALINDEX_CHUNK_MIN);
+    }
+    if (threads > size)
+        threads = (int)size;
+    if (threads < 1)
+        threads = 1;
+
+    // 1. find the start codes, chunk by chunk
+    std::vector<std::vector<uint64_t> > chunkStarts(threads);
+    int64_t chunk = (size + threads - 1) / threads;
+    parallelFor(threads, (size_t)threads, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c)
+        {
+            int64_t from = (int64_t)c * chunk;
+            int64_t to = from + chunk < size ? from + chunk : size;
+            scanChunk(data, size, from, to, chunkStarts[c]);
+        }
+    });
+
+    std::vector<uint64_t> starts;
+    for (int c = 0; c < threads; ++c)
+        starts.insert(starts.end(), chunkStarts[c].begin(), chunkStarts[c].end());
+    chunkStarts.clear();
+
+    // 2. classify the NAL units, a NAL unit ends where the next start code begins
+    std::vector<NalIndexEntry> nals(starts.size());
+    parallelFor(threads, starts.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const uint8_t *r = data + starts[i];
+            const uint8_t *last = i + 1 < starts.size() ? data + starts[i + 1] - 3 : data + size;
+            while (last > r && !last[-1]) // trailing_zero_8bits, and the leading zero of a 4 byte start code
+                --last;
+
+            NalIndexEntry &e = nals[i];
+            memset(&e, 0, sizeof(e));
+            e.offset = starts[i];
+            e.length = (uint32_t)(last - r);
+            if (e.length < 2)
+                continue; // no NAL unit header, dropped below
+
+            e.type = (r[0] >> 1) & 0x3f;
+            e.tid = (r[1] & 0x07) ? (r[1] & 0x07) - 1 : 0;
+            if (e.type >= 16 && e.type <= 23)
+                e.flags |= NAL_FLAG_IRAP;
+            if (e.type < 32 && e.length > 2 && (r[2] & 0x80)) // first_slice_segment_in_pic_flag
+                e.flags |= NAL_FLAG_FIRST_SLICE;
+        }
+    });
+
+    // 3. access unit boundaries depend on the NAL units before, that part is sequential but cheap
+    entries.reserve(nals.size());
+    bool picture = false; // the current access unit already has a VCL NAL unit
+    for (size_t i = 0; i < nals.size(); ++i)
+    {
+        NalIndexEntry &e = nals[i];
+        if (e.length < 2)
+            continue;
+
+        bool vcl = e.type < 32;
+        if (entries.empty() || (picture && (startsAccessUnit(e.type) || (e.flags & NAL_FLAG_FIRST_SLICE))))
+        {
+            e.flags |= NAL_FLAG_AU_START;
+            picture = false;
+        }
+        if (vcl)
+            picture = true;
+
+        entries.push_back(e);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define NALINDEX_VERSION 2
+#define NALINDEX_SUFFIX ".nalidx" // sidecar file next to the media file
+#define NALINDEX_CHUNK_MIN (16 * 1024 * 1024) // smallest piece of a file one indexing thread scans
+
+// NalIndexEntry::flags
+#define NAL_FLAG_IRAP 0x01     // BLA/IDR/CRA picture, decoding can start here
+#define NAL_FLAG_AU_START 0x02 // first NAL unit of an access unit
+#define NAL_FLAG_FIRST_SLICE 0x04 // VCL NAL unit with first_slice_segment_in_pic_flag set
+
+/**
+   One NAL unit of an Annex-B file: where it is (without start code) and what it is.
+ */
+struct NalIndexEntry
+{
+    uint64_t offset; // of the NAL unit header in the file
+    uint32_t length; // NAL unit header + payload, trailing zero bytes stripped
+    uint8_t type;    // nal_unit_type
+    uint8_t tid;     // TemporalId (nuh_temporal_id_plus1 - 1)
+    uint8_t flags;   // NAL_FLAG_xxx
+    uint8_t reserved;
+};
+
+/**
+   Sidecar file layout: this header followed by count NalIndexEntry records.
+   The source size and modification time tell whether the index still matches the media file.
+ */
+struct NalIndexHeader
+{
+    char magic[8];     // "HEVCNIDX"
+    uint32_t version;  // NALINDEX_VERSION
+    uint32_t entrySize; // sizeof(NalIndexEntry)
+    uint64_t count;
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+};
+
+/**
+   Index of the NAL units of an H.265 Annex-B file, so serving a NAL unit is an array lookup.
+
+   The index is built once by scanning the file for start codes (large files in parallel chunks
+   on all cores) and stored as a versioned sidecar file (file.hevc.nalidx). Later runs map the
+   sidecar read only instead of scanning,
+   as long as its version and the size and mtime of the media file match and its entries all lie
+   inside the file. If the sidecar can't
+   be written (read only directory) the index just lives in memory.
+ */
+class CNalIndex
+{
+public:
+    CNalIndex();
+    ~CNalIndex();
+
+    /// load the sidecar of file, or build the index from data (the mapped file) and store it
+    bool open(const char *file, const uint8_t *data, int64_t size);
+    void close();
+
+    size_t count() const { return m_Count; }
+    const NalIndexEntry &entry(size_t i) const { return m_Entries[i]; }
+    size_t accessUnits() const { return m_AuNals.size(); }
+    size_t accessUnitNal(size_t au) const { return m_AuNals[au]; }       // first NAL unit of access unit au
+    uint64_t accessUnitBytes(size_t au) const { return m_AuBytes[au]; } // NAL unit bytes (no start codes) of access unit au
+    int maxTemporalId() const { return m_MaxTid; } // highest TemporalId of a picture in the file
+
+    /// index an Annex-B buffer split over threads threads (0 = one per core for files of several NALINDEX_CHUNK_MIN)
+    static void build(const uint8_t *data, int64_t size, std::vector<NalIndexEntry> &entries, int threads = 0);
+
+private:
+    bool load(const char *sidecar, uint64_t sourceSize, int64_t sourceMtimeNs);
+    bool store(const char *sidecar, uint64_t sourceSize, int64_t sourceMtimeNs);
+    void indexAccessUnits();
+
+    const NalIndexEntry *m_Entries;
+    size_t m_Count;
+    std::vector<size_t> m_AuNals;    // first NAL unit of each access unit
+    std::vector<uint64_t> m_AuBytes; // and its size, for looking ahead
+    int m_MaxTid;
+
+    void *m_Map; // mapped sidecar, if loaded
+    size_t m_MapSize;
+    std::vector<NalIndexEntry> m_Built; // freshly built index
+};
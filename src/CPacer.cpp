@@ -0,0 +1,76 @@
+#include "CPacer.h"
+
+CPacer::CPacer()
+{
+    m_FrameIntervalNs = 0;
+    m_SpreadNs = 0;
+    m_TargetBytesPerSec = 0;
+    m_Drained = 0;
+    m_SmoothFrames = 0;
+}
+
+void CPacer::configure(uint64_t frameIntervalNs, int spreadPercent, int targetKbps, int smoothFrames)
+{
+    m_FrameIntervalNs = frameIntervalNs;
+    m_SmoothFrames = smoothFrames > 0 ? smoothFrames : 0;
+    m_SpreadNs = frameIntervalNs * spreadPercent / 100;
+    m_TargetBytesPerSec = (uint64_t)targetKbps * 1000 / 8;
+    m_Drained = 0;
+}
+
+void CPacer::schedule(RtpPacket *const *pkts, size_t count, uint64_t nowNs, int aheadFrames, const uint64_t *nextBytes, size_t next)
+{
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; ++i)
+        bytes += pkts[i]->len;
+
+    // rate of this access unit in bytes per second
+    uint64_t rate = m_TargetBytesPerSec;
+    if (m_SpreadNs && bytes * 1000000000ULL / m_SpreadNs > rate)
+        rate = bytes * 1000000000ULL / m_SpreadNs;
+    if (m_SmoothFrames)
+    {
+        // the window decides, the spread only sets the deadlines
+        uint64_t smooth = smoothRate(bytes, nowNs, aheadFrames, nextBytes, next);
+        rate = smooth > m_TargetBytesPerSec ? smooth : m_TargetBytesPerSec;
+    }
+    if (!rate)
+    {
+        for (size_t i = 0; i < count; ++i)
+            pkts[i]->due = nowNs;
+        return;
+    }
+
+    // GCRA: the bucket drains at rate, after an idle period it holds a burst worth of credit
+    uint64_t burstNs = (uint64_t)RTP_PACE_BURST_BYTES * 1000000000ULL / rate;
+    if (m_Drained + burstNs < nowNs)
+        m_Drained = nowNs - burstNs;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        pkts[i]->due = m_Drained > nowNs ? m_Drained : nowNs;
+        m_Drained += (uint64_t)pkts[i]->len * 1000000000ULL / rate;
+    }
+}
+
+/**
+   Lowest constant rate that sends this access unit (bytes) and each of the next ones by its deadline,
+   starting when the bucket has drained what is scheduled already.
+ */
+uint64_t CPacer::smoothRate(uint64_t bytes, uint64_t nowNs, int aheadFrames, const uint64_t *nextBytes, size_t next)
+{
+    uint64_t start = m_Drained > nowNs ? m_Drained : nowNs;
+    uint64_t deadline = nowNs + (uint64_t)aheadFrames * m_FrameIntervalNs + (m_SpreadNs ? m_SpreadNs : m_FrameIntervalNs);
+    uint64_t total = bytes;
+    uint64_t rate = 0;
+    for (size_t i = 0;; ++i)
+    {
+        uint64_t span = deadline > start + RTP_PACE_MIN_SPAN_NS ? deadline - start : RTP_PACE_MIN_SPAN_NS;
+        if (total * 1000000000ULL / span > rate)
+            rate = total * 1000000000ULL / span;
+        if (i == next)
+            return rate;
+        total += nextBytes[i];
+        deadline += m_FrameIntervalNs;
+    }
+}
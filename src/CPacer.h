@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "RtpPacket.h"
+
+#define RTP_PACE_BURST_BYTES (4 * 1500) // a paced stream may still send this much back to back
+#define RTP_PACE_MIN_SPAN_NS 1000000     // a late access unit still gets this long, rather than an unbounded rate
+
+/**
+   Token bucket pacer of one stream.
+
+   Instead of handing all packets of an access unit to the NIC in one burst (a 150 KB IRAP is
+   ~100 packets), every packet gets a departure time. An access unit is spread over spreadPercent
+   of the frame interval, and never sent faster than needed for that or the target bitrate,
+   whichever is higher. Up to RTP_PACE_BURST_BYTES may leave back to back after an idle period.
+
+   With smoothing the streamer sends access units up to smoothFrames frame intervals before their
+   time and tells the pacer the sizes of the ones that follow. The rate is then the lowest constant
+   rate that still gets each access unit of that lookahead window out by its own deadline (the end
+   of its spread, or of its frame interval), so a large IRAP is sent early, in the gaps left by the
+   small pictures before it, instead of raising the rate for one frame.
+ */
+class CPacer
+{
+public:
+    CPacer();
+
+    /// spreadPercent of the frame interval per access unit (0 = off), targetKbps minimum rate (0 = none),
+    /// smoothFrames how many frame intervals early an access unit may be sent (0 = no smoothing)
+    void configure(uint64_t frameIntervalNs, int spreadPercent, int targetKbps, int smoothFrames = 0);
+    bool enabled() { return m_SpreadNs != 0 || m_TargetBytesPerSec != 0 || m_SmoothFrames != 0; }
+    int smoothFrames() { return m_SmoothFrames; }
+
+    /**
+       Set RtpPacket::due of the packets of one access unit, built at nowNs. With smoothing it is sent
+       aheadFrames frame intervals before its time and nextBytes[0..next) are the sizes of the access
+       units after it.
+     */
+    void schedule(RtpPacket *const *pkts, size_t count, uint64_t nowNs, int aheadFrames = 0, const uint64_t *nextBytes = NULL,
+                  size_t next = 0);
+
+private:
+    uint64_t smoothRate(uint64_t bytes, uint64_t nowNs, int aheadFrames, const uint64_t *nextBytes, size_t next);
+
+    uint64_t m_FrameIntervalNs;
+    uint64_t m_SpreadNs;          // an access unit is sent within this time
+    uint64_t m_TargetBytesPerSec; // but not slower than this
+    uint64_t m_Drained;           // the bucket has sent everything scheduled so far at this time
+    int m_SmoothFrames;           // lookahead, in frames
+};
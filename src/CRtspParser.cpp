@@ -0,0 +1,348 @@
+#include "CRtspParser.h"
+#include <string.h>
+#include <strings.h>
+
+struct RtspHeaderName
+{
+    const char *name;
+    unsigned len;
+    RTSP_HEADER_IDS id;
+};
+
+// indexed by the perfect hash of rtspHeaderId(): ((len << 1) + name[1] + name[len - 4]) & 31, in lower case
+static const RtspHeaderName headerTable[32] = {
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 0
+    {"proxy-require", 13, RTSP_HDR_PROXY_REQUIRE},     // 1
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 2
+    {"authorization", 13, RTSP_HDR_AUTHORIZATION},     // 3
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 4
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 5
+    {"session", 7, RTSP_HDR_SESSION},                  // 6
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 7
+    {"require", 7, RTSP_HDR_REQUIRE},                  // 8
+    {"content-base", 12, RTSP_HDR_CONTENT_BASE},       // 9
+    {"speed", 5, RTSP_HDR_SPEED},                      // 10
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 11
+    {"range", 5, RTSP_HDR_RANGE},                      // 12
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 13
+    {"user-agent", 10, RTSP_HDR_USER_AGENT},           // 14
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 15
+    {"scale", 5, RTSP_HDR_SCALE},                      // 16
+    {"blocksize", 9, RTSP_HDR_BLOCKSIZE},              // 17
+    {"accept", 6, RTSP_HDR_ACCEPT},                    // 18
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 19
+    {"transport", 9, RTSP_HDR_TRANSPORT},              // 20
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 21
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 22
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 23
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 24
+    {"content-length", 14, RTSP_HDR_CONTENT_LENGTH},   // 25
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 26
+    {"content-type", 12, RTSP_HDR_CONTENT_TYPE},       // 27
+    {"bandwidth", 9, RTSP_HDR_BANDWIDTH},              // 28
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 29
+    {"cseq", 4, RTSP_HDR_CSEQ},                        // 30
+    {NULL, 0, RTSP_HDR_UNKNOWN},                       // 31
+};
+
+RTSP_HEADER_IDS rtspHeaderId(const char *name, unsigned len)
+{
+    if (len < 4)
+        return RTSP_HDR_UNKNOWN;
+
+    // letters | 0x20 are lower case, '-' stays
+    const RtspHeaderName &h = headerTable[((len << 1) + (name[1] | 0x20) + (name[len - 4] | 0x20)) & 31];
+    if (h.len != len || strncasecmp(h.name, name, len) != 0)
+        return RTSP_HDR_UNKNOWN;
+    return h.id;
+}
+
+static RTSP_CMD_TYPES methodType(const char *name, unsigned len)
+{
+    switch (len)
+    {
+    case 4:
+        return memcmp(name, "PLAY", 4) == 0 ? RTSP_PLAY : RTSP_UNKNOWN;
+    case 5:
+        return memcmp(name, "SETUP", 5) == 0 ? RTSP_SETUP : RTSP_UNKNOWN;
+    case 7:
+        return memcmp(name, "OPTIONS", 7) == 0 ? RTSP_OPTIONS : RTSP_UNKNOWN;
+    case 8:
+        if (memcmp(name, "DESCRIBE", 8) == 0)
+            return RTSP_DESCRIBE;
+        return memcmp(name, "TEARDOWN", 8) == 0 ? RTSP_TEARDOWN : RTSP_UNKNOWN;
+    }
+    return RTSP_UNKNOWN;
+}
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool rtspStrEquals(RtspStr s, const char *literal)
+{
+    return strlen(literal) == s.len && memcmp(s.ptr, literal, s.len) == 0;
+}
+
+bool rtspStrToUnsigned(RtspStr s, unsigned *value)
+{
+    if (s.len == 0 || s.len > 9) // no overflow
+        return false;
+    unsigned v = 0;
+    for (unsigned i = 0; i < s.len; ++i)
+    {
+        if (!isDigit(s.ptr[i]))
+            return false;
+        v = v * 10 + (s.ptr[i] - '0');
+    }
+    *value = v;
+    return true;
+}
+
+bool rtspParseTransport(RtspStr transport, bool *tcp, uint16_t *clientPort)
+{
+    const char *p = transport.ptr;
+    const char *end = p + transport.len;
+    const char *comma = (const char *)memchr(p, ',', transport.len);
+    if (comma)
+        end = comma; // alternatives follow, we take the first
+
+    if (end - p < 7 || memcmp(p, "RTP/AVP", 7) != 0) // std says this is mandatory part
+        return false;
+    p += 7;
+
+    *tcp = false;
+    if (end - p >= 4 && (memcmp(p, "/TCP", 4) == 0 || memcmp(p, "/UDP", 4) == 0))
+    {
+        *tcp = p[1] == 'T';
+        p += 4;
+    }
+
+    // sub-params like client_port=7000-7001, separated by ';'
+    *clientPort = 0;
+    while (p < end)
+    {
+        const char *semi = (const char *)memchr(p, ';', end - p);
+        const char *paramEnd = semi ? semi : end;
+        while (p < paramEnd && (isBlank(*p) || *p == '\r' || *p == '\n')) // folded lines
+            ++p;
+
+        if (paramEnd - p > 12 && memcmp(p, "client_port=", 12) == 0)
+        {
+            RtspStr port = {p + 12, 0};
+            while (port.ptr + port.len < paramEnd && isDigit(port.ptr[port.len]))
+                ++port.len;
+            unsigned value;
+            if (!rtspStrToUnsigned(port, &value) || value > 0xffff)
+                return false;
+            *clientPort = (uint16_t)value;
+        }
+        p = semi ? semi + 1 : end;
+    }
+    return true;
+}
+
+/*
+   METHOD rtsp://server.example.com:554/live/1[/track1] RTSP/1.0
+   or METHOD * RTSP/1.0
+ */
+bool CRtspParser::parseRequestLine(const char *line, const char *end, RtspRequest *req)
+{
+    const char *p = line;
+    while (p < end && !isBlank(*p))
+        ++p;
+    req->methodName.ptr = line;
+    req->methodName.len = p - line;
+    req->method = methodType(line, p - line);
+
+    while (p < end && isBlank(*p))
+        ++p;
+    const char *uri = p;
+    while (p < end && !isBlank(*p))
+        ++p;
+    const char *uriEnd = p;
+    req->uri.ptr = uri;
+    req->uri.len = uriEnd - uri;
+    if (req->methodName.len == 0 || req->uri.len == 0)
+        return false;
+
+    while (p < end && isBlank(*p))
+        ++p;
+    if (end - p != 8 || memcmp(p, "RTSP/", 5) != 0 || !isDigit(p[5]) || p[6] != '.' || !isDigit(p[7]))
+        return false;
+
+    if (rtspStrEquals(req->uri, "*"))
+        return true;
+
+    // host:port, presentation and stream, the rest (like a track) is ignored
+    if (uriEnd - uri < 7 || strncasecmp(uri, "rtsp://", 7) != 0)
+        return false;
+    p = uri + 7;
+    RtspStr *parts[3] = {&req->hostPort, &req->presentation, &req->stream};
+    for (int i = 0; i < 3; ++i)
+    {
+        while (i && p < uriEnd && *p == '/') // vlc sometimes puts extra /
+            ++p;
+        parts[i]->ptr = p;
+        while (p < uriEnd && *p != '/')
+            ++p;
+        parts[i]->len = p - parts[i]->ptr;
+        if (i < 2 && p == uriEnd) // no next part
+            return false;
+    }
+    return true;
+}
+
+// header lines [pos, end), each ending in CRLF
+bool CRtspParser::parseHeaders(const char *pos, const char *end, RtspRequest *req)
+{
+    while (pos < end)
+    {
+        // a header line, continued by the lines that start with a space or tab
+        const char *lineEnd = pos;
+        for (;;)
+        {
+            lineEnd = (const char *)memchr(lineEnd, '\r', end - lineEnd);
+            if (!lineEnd || lineEnd[1] != '\n')
+                return false;
+            if (lineEnd + 2 < end && isBlank(lineEnd[2]))
+            {
+                lineEnd += 2;
+                continue;
+            }
+            break;
+        }
+
+        const char *colon = (const char *)memchr(pos, ':', lineEnd - pos);
+        if (!colon)
+            return false;
+        const char *nameEnd = colon;
+        while (nameEnd > pos && isBlank(nameEnd[-1]))
+            --nameEnd;
+
+        RTSP_HEADER_IDS id = rtspHeaderId(pos, nameEnd - pos);
+        if (id != RTSP_HDR_UNKNOWN)
+        {
+            const char *value = colon + 1;
+            const char *valueEnd = lineEnd;
+            while (value < valueEnd && isBlank(*value))
+                ++value;
+            while (valueEnd > value && isBlank(valueEnd[-1]))
+                --valueEnd;
+            RtspStr &s = req->headers[id];
+            s.ptr = value;
+            s.len = valueEnd - value;
+
+            if (id == RTSP_HDR_CSEQ && !rtspStrToUnsigned(s, &req->cseq))
+                return false;
+            if (id == RTSP_HDR_CONTENT_LENGTH && (!rtspStrToUnsigned(s, &req->contentLength) || req->contentLength > RTSP_MAX_BODY))
+                return false;
+        }
+        pos = lineEnd + 2;
+    }
+    return true;
+}
+
+// consume what is here of the size bytes at start, the rest is dropped by the next parse() calls
+int CRtspParser::skip(size_t start, size_t avail, size_t size, RtspRequest *req)
+{
+    size_t here = avail < size ? avail : size;
+    m_Skip = size - here;
+    m_Scanned = 0;
+    req->body.len = 0;
+    return (int)(start + here);
+}
+
+int CRtspParser::parse(const char *buf, size_t len, RtspRequest *req)
+{
+    memset(req, 0, sizeof(*req));
+    req->method = RTSP_UNKNOWN;
+    req->channel = -1;
+
+    if (m_Skip)
+    {
+        size_t n = len < m_Skip ? len : m_Skip;
+        m_Skip -= n;
+        req->skipped = true;
+        return (int)n;
+    }
+
+    // empty lines between requests are allowed
+    size_t start = 0;
+    while (start + 2 <= len && buf[start] == '\r' && buf[start + 1] == '\n')
+        start += 2;
+    if (start == len)
+        return 0;
+
+    const char *p = buf + start;
+    size_t avail = len - start;
+    if (*p == '$') // interleaved frame: '$', channel, 16 bit length
+    {
+        if (avail < 4)
+            return 0;
+        unsigned size = ((uint8_t)p[2] << 8) | (uint8_t)p[3];
+        req->channel = (uint8_t)p[1];
+        if (4 + size > m_MaxSize)
+        {
+            req->skipped = true;
+            return skip(start, avail, 4 + size, req);
+        }
+        if (avail < 4 + size)
+            return 0;
+        req->body.ptr = p + 4;
+        req->body.len = size;
+        return (int)(start + 4 + size);
+    }
+
+    // the header ends with an empty line, search the new bytes only
+    const char *hdrEnd = NULL;
+    size_t i = m_Scanned > start ? m_Scanned : start;
+    while (i + 4 <= len)
+    {
+        const char *cr = (const char *)memchr(buf + i, '\r', len - 3 - i);
+        if (!cr)
+        {
+            i = len - 3;
+            break;
+        }
+        if (memcmp(cr, "\r\n\r\n", 4) == 0)
+        {
+            hdrEnd = cr + 4;
+            break;
+        }
+        i = cr - buf + 1;
+    }
+    if (!hdrEnd)
+    {
+        m_Scanned = i;
+        return 0;
+    }
+    m_Scanned = hdrEnd - buf - 4; // found right away again while the body is incomplete
+
+    const char *lineEnd = (const char *)memchr(p, '\r', hdrEnd - p);
+    if (lineEnd[1] != '\n' || !parseRequestLine(p, lineEnd, req) || !parseHeaders(lineEnd + 2, hdrEnd - 2, req))
+    {
+        m_Scanned = 0;
+        return -1;
+    }
+
+    if ((size_t)(hdrEnd - p) + req->contentLength > m_MaxSize)
+    {
+        req->tooLarge = true;
+        return skip(start, avail, (hdrEnd - p) + req->contentLength, req);
+    }
+
+    size_t total = (hdrEnd - buf) + req->contentLength;
+    if (total > len)
+        return 0;
+    req->body.ptr = hdrEnd;
+    req->body.len = req->contentLength;
+    m_Scanned = 0;
+    return (int)total;
+}
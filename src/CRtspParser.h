@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RTSP_MAX_BODY 65535 // larger Content-Length is malformed; smaller ones that don't fit the receive buffer are skipped
+
+// supported command types
+enum RTSP_CMD_TYPES
+{
+    RTSP_OPTIONS,
+    RTSP_DESCRIBE,
+    RTSP_SETUP,
+    RTSP_PLAY,
+    RTSP_TEARDOWN,
+    RTSP_UNKNOWN
+};
+
+// request headers we know, found through a perfect hash of their name (see rtspHeaderId)
+enum RTSP_HEADER_IDS
+{
+    RTSP_HDR_CSEQ,
+    RTSP_HDR_CONTENT_LENGTH,
+    RTSP_HDR_CONTENT_TYPE,
+    RTSP_HDR_CONTENT_BASE,
+    RTSP_HDR_TRANSPORT,
+    RTSP_HDR_SESSION,
+    RTSP_HDR_RANGE,
+    RTSP_HDR_SCALE,
+    RTSP_HDR_SPEED,
+    RTSP_HDR_USER_AGENT,
+    RTSP_HDR_ACCEPT,
+    RTSP_HDR_REQUIRE,
+    RTSP_HDR_PROXY_REQUIRE,
+    RTSP_HDR_BANDWIDTH,
+    RTSP_HDR_BLOCKSIZE,
+    RTSP_HDR_AUTHORIZATION,
+    RTSP_HDR_COUNT,
+    RTSP_HDR_UNKNOWN = RTSP_HDR_COUNT
+};
+
+/// a piece of the receive buffer, not NUL terminated
+struct RtspStr
+{
+    const char *ptr;
+    unsigned len;
+};
+
+/**
+   One request (or interleaved binary frame) as parsed by CRtspParser. All strings point into the
+   receive buffer, so they are valid until the caller moves or overwrites what parse() consumed.
+ */
+struct RtspRequest
+{
+    RTSP_CMD_TYPES method;     // RTSP_UNKNOWN for methods we don't serve (see methodName) and for interleaved frames
+    RtspStr methodName;
+    RtspStr uri;               // as sent, "*" or rtsp://host[:port]/presentation/stream[/...]
+    RtspStr hostPort;          // parts of uri, empty for "*"
+    RtspStr presentation;
+    RtspStr stream;
+    unsigned cseq;
+    unsigned contentLength;
+    RtspStr headers[RTSP_HDR_COUNT]; // values of the known headers, continuation lines included; len 0 if absent
+    RtspStr body;              // contentLength bytes after the header, or the payload of an interleaved frame
+    int channel;               // interleaved frame ('$'): its channel, -1 for requests
+    bool tooLarge;             // a request that does not fit the receive buffer: its body is skipped, answer 413
+    bool skipped;              // nothing to serve: bytes of a body or interleaved frame too large for the buffer
+};
+
+/**
+   Incremental RTSP request parser, one per session. It works in place on the session's receive
+   buffer and allocates nothing: parse() is called on the unconsumed bytes after every read and
+   hands out each complete request (header and Content-Length body) in turn, so several pipelined
+   requests in one read are all served. RTP/RTCP frames a client interleaves on the connection
+   ("$", channel, length) are handed out as requests of channel >= 0.
+
+   Until the empty line ending the header arrived, parse() remembers how far it searched, so a
+   request trickling in over many reads is scanned once.
+
+   A request or frame larger than maxSize (the receive buffer) could never be complete in it. It
+   is refused as soon as its size is known: the header of a request is handed out as tooLarge,
+   interleaved frames are dropped, and the bytes after that are skipped as they arrive.
+ */
+class CRtspParser
+{
+public:
+    explicit CRtspParser(size_t maxSize) : m_MaxSize(maxSize), m_Scanned(0), m_Skip(0) {}
+
+    /// parse the request at the start of buf[0..len): returns its size once it is complete (req filled in),
+    /// 0 if more bytes are needed, -1 if it is malformed (the connection can't be resynchronized)
+    int parse(const char *buf, size_t len, RtspRequest *req);
+    /// forget a partial request, the buffer was dropped
+    void reset() { m_Scanned = 0; m_Skip = 0; }
+
+private:
+    bool parseRequestLine(const char *line, const char *end, RtspRequest *req);
+    bool parseHeaders(const char *pos, const char *end, RtspRequest *req);
+
+    int skip(size_t start, size_t avail, size_t size, RtspRequest *req);
+
+    size_t m_MaxSize; // largest request or interleaved frame we take
+    size_t m_Scanned; // bytes of the pending request known not to hold the end of its header
+    size_t m_Skip;    // bytes still to drop of a request body or frame larger than m_MaxSize
+};
+
+/// RTSP_HDR_xxx of a header name (any case), RTSP_HDR_UNKNOWN if we don't know it
+RTSP_HEADER_IDS rtspHeaderId(const char *name, unsigned len);
+
+bool rtspStrEquals(RtspStr s, const char *literal);                  // case sensitive
+bool rtspStrToUnsigned(RtspStr s, unsigned *value);                  // digits only, no overflow
+/// the first transport of a Transport header: RTP/AVP[/UDP] or RTP/AVP/TCP, and client_port (0 if none)
+bool rtspParseTransport(RtspStr transport, bool *tcp, uint16_t *clientPort);
@@ -0,0 +1,188 @@
+#include "CRtspResponses.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const fieldNames[RTSP_FIELD_NONE] = {
+    "{cseq}", "{date}", "{session}", "{url}", "{client_rtp_port}", "{client_rtcp_port}", "{server_rtp_port}", "{server_rtcp_port}",
+    "{server_addr}", "{content_length}", "{seq}", "{rtptime}",
+};
+
+void CRtspTemplate::compile(const std::string &text)
+{
+    m_Text.clear();
+    m_Pieces.clear();
+
+    size_t pos = 0;
+    for (;;)
+    {
+        Piece piece = {m_Text.size(), 0, RTSP_FIELD_NONE};
+        size_t next = std::string::npos;
+        for (int f = 0; f < RTSP_FIELD_NONE; ++f)
+        {
+            size_t at = text.find(fieldNames[f], pos);
+            if (at < next)
+            {
+                next = at;
+                piece.field = (RTSP_FIELD_IDS)f;
+            }
+        }
+
+        m_Text.append(text, pos, next == std::string::npos ? std::string::npos : next - pos);
+        piece.len = m_Text.size() - piece.offset;
+        m_Pieces.push_back(piece);
+        if (next == std::string::npos)
+            break;
+        pos = next + strlen(fieldNames[piece.field]);
+    }
+}
+
+static char *putUnsigned(char *p, unsigned v)
+{
+    char digits[10];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+size_t CRtspTemplate::render(char *out, size_t size, const RtspResponseArgs &args) const
+{
+    char *p = out;
+    char *end = out + size;
+    for (size_t i = 0; i < m_Pieces.size(); ++i)
+    {
+        const Piece &piece = m_Pieces[i];
+        if ((size_t)(end - p) < piece.len + 16) // room for the piece and a number
+            return 0;
+        memcpy(p, m_Text.data() + piece.offset, piece.len);
+        p += piece.len;
+
+        switch (piece.field)
+        {
+        case RTSP_FIELD_CSEQ:
+            p = putUnsigned(p, args.cseq);
+            break;
+        case RTSP_FIELD_SESSION:
+            if (args.session < 0)
+                *p++ = '-';
+            p = putUnsigned(p, args.session < 0 ? 0u - (unsigned)args.session : (unsigned)args.session);
+            break;
+        case RTSP_FIELD_CLIENT_RTP_PORT:
+            p = putUnsigned(p, args.clientRtpPort);
+            break;
+        case RTSP_FIELD_CLIENT_RTCP_PORT:
+            p = putUnsigned(p, args.clientRtcpPort);
+            break;
+        case RTSP_FIELD_SERVER_RTP_PORT:
+            p = putUnsigned(p, args.serverRtpPort);
+            break;
+        case RTSP_FIELD_SERVER_RTCP_PORT:
+            p = putUnsigned(p, args.serverRtcpPort);
+            break;
+        case RTSP_FIELD_CONTENT_LENGTH:
+            p = putUnsigned(p, args.contentLength);
+            break;
+        case RTSP_FIELD_SEQ:
+            p = putUnsigned(p, args.seq);
+            break;
+        case RTSP_FIELD_RTPTIME:
+            p = putUnsigned(p, args.rtptime);
+            break;
+        case RTSP_FIELD_SERVER_ADDR:
+            if ((size_t)(end - p) < args.serverAddr.len)
+                return 0;
+            memcpy(p, args.serverAddr.ptr, args.serverAddr.len);
+            p += args.serverAddr.len;
+            break;
+        case RTSP_FIELD_DATE:
+        {
+            const char *date = rtspDateHeader();
+            size_t len = strlen(date);
+            if ((size_t)(end - p) < len)
+                return 0;
+            memcpy(p, date, len);
+            p += len;
+            break;
+        }
+        case RTSP_FIELD_URL:
+        {
+            const RtspStr parts[3] = {args.host, args.presentation, args.stream};
+            for (int k = 0; k < 3; ++k)
+            {
+                if ((size_t)(end - p) < parts[k].len + 1)
+                    return 0;
+                if (k)
+                    *p++ = '/';
+                memcpy(p, parts[k].ptr, parts[k].len);
+                p += parts[k].len;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return p - out;
+}
+
+CRtspResponses::CRtspResponses(const std::string &sdpText) : m_Sdp(sdpText)
+{
+    options.compile("RTSP/1.0 200 OK\r\nCSeq: {cseq}\r\n"
+                    "Public: DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE\r\n\r\n");
+    describe.compile("RTSP/1.0 200 OK\r\nCSeq: {cseq}\r\n"
+                     "{date}\r\n"
+                     "Content-Base: rtsp://{url}/\r\n"
+                     "Content-Type: application/sdp\r\n"
+                     "Content-Length: {content_length}\r\n\r\n");
+    sdp.compile(sdpText);
+    notFound.compile("RTSP/1.0 404 Stream Not Found\r\nCSeq: {cseq}\r\n{date}\r\n\r\n");
+    setupUdp.compile("RTSP/1.0 200 OK\r\nCSeq: {cseq}\r\n"
+                     "{date}\r\n"
+                     "Transport: RTP/AVP;unicast;"
+                     "client_port={client_rtp_port}-{client_rtcp_port};server_port={server_rtp_port}-{server_rtcp_port}\r\n"
+                     "Session: {session}\r\n\r\n");
+    setupTcp.compile("RTSP/1.0 200 OK\r\nCSeq: {cseq}\r\n"
+                     "{date}\r\n"
+                     "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"
+                     "Session: {session}\r\n\r\n");
+    play.compile("RTSP/1.0 200 OK\r\nCSeq: {cseq}\r\n"
+                 "{date}\r\n"
+                 "Range: npt=0.000-\r\n"
+                 "Session: {session}\r\n"
+                 "RTP-Info: url=rtsp://{url};seq={seq};rtptime={rtptime}\r\n\r\n");
+}
+
+size_t CRtspResponses::renderDescribe(char *out, size_t size, RtspResponseArgs &args) const
+{
+    char body[RTSP_SDP_MAX];
+    args.contentLength = sdp.render(body, sizeof(body), args);
+    if (!args.contentLength)
+        return 0;
+    size_t len = describe.render(out, size, args);
+    if (!len || size - len < args.contentLength)
+        return 0;
+    memcpy(out + len, body, args.contentLength);
+    return len + args.contentLength;
+}
+
+const char *rtspDateHeader()
+{
+    // per thread, so the workers don't share a line
+    static __thread time_t second = -1;
+    static __thread char header[64];
+
+    time_t now = time(NULL);
+    if (now != second)
+    {
+        struct tm tm;
+        strftime(header, sizeof(header), "Date: %a, %b %d %Y %H:%M:%S GMT", gmtime_r(&now, &tm));
+        second = now;
+    }
+    return header;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "CRtspParser.h"
+#include "platglue.h"
+#include <string>
+#include <vector>
+
+#define RTSP_SDP_MAX 1536 // rendered session description, parameter sets included
+
+// what a response template splices in
+enum RTSP_FIELD_IDS
+{
+    RTSP_FIELD_CSEQ,
+    RTSP_FIELD_DATE,             // "Date: ..." line without its CRLF, see rtspDateHeader()
+    RTSP_FIELD_SESSION,
+    RTSP_FIELD_URL,              // host:port/presentation/stream of the request
+    RTSP_FIELD_CLIENT_RTP_PORT,
+    RTSP_FIELD_CLIENT_RTCP_PORT,
+    RTSP_FIELD_SERVER_RTP_PORT,
+    RTSP_FIELD_SERVER_RTCP_PORT,
+    RTSP_FIELD_SERVER_ADDR,      // our address on the client's connection, for the SDP origin
+    RTSP_FIELD_CONTENT_LENGTH,
+    RTSP_FIELD_SEQ,              // RTP-Info: the first packet the session gets after PLAY
+    RTSP_FIELD_RTPTIME,
+    RTSP_FIELD_NONE
+};
+
+// values for the fields of one response
+struct RtspResponseArgs
+{
+    unsigned cseq;
+    int session;
+    RtspStr host, presentation, stream;
+    unsigned clientRtpPort, clientRtcpPort;
+    unsigned serverRtpPort, serverRtcpPort;
+    RtspStr serverAddr;
+    unsigned contentLength;
+    unsigned seq;
+    uint32_t rtptime;
+};
+
+/**
+   A response rendered ahead of time, up to its per request fields: a text with {cseq}, {date},
+   {session}, {url}, {client_rtp_port}, ... in it is split once into literal pieces and fields,
+   render() then only copies and formats the numbers.
+ */
+class CRtspTemplate
+{
+public:
+    void compile(const std::string &text);
+    /// the response into out, its length (0 if it does not fit)
+    size_t render(char *out, size_t size, const RtspResponseArgs &args) const;
+
+private:
+    struct Piece
+    {
+        size_t offset, len;  // literal text in m_Text
+        RTSP_FIELD_IDS field; // spliced in after it
+    };
+    std::string m_Text;
+    std::vector<Piece> m_Pieces;
+};
+
+/**
+   The responses of one stream, rendered once and shared by all the sessions on it. The SDP is a
+   template of its own ({server_addr} in its origin line), renderDescribe() puts it behind the
+   DESCRIBE header with the Content-Length it came to.
+ */
+class CRtspResponses
+{
+public:
+    explicit CRtspResponses(const std::string &sdp);
+
+    const std::string &getSdp() const { return m_Sdp; }
+    /// the DESCRIBE answer with its SDP body into out, its length (0 if it does not fit)
+    size_t renderDescribe(char *out, size_t size, RtspResponseArgs &args) const;
+
+    CRtspTemplate options;
+    CRtspTemplate describe; // header only, see renderDescribe()
+    CRtspTemplate sdp;
+    CRtspTemplate notFound;
+    CRtspTemplate setupUdp;
+    CRtspTemplate setupTcp;
+    CRtspTemplate play;
+
+private:
+    std::string m_Sdp;
+};
+
+/// "Date: ..." of the current second (no CRLF), formatted once a second per thread
+const char *rtspDateHeader();
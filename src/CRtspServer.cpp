@@ -0,0 +1,502 @@
+#include "CRtspServer.h"
+#include "CRtspSession.h"
+#include "SimStreamer.h"
+#include <sys/epoll.h>
+#include <time.h>
+
+static uint64_t monotonicNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//===========================================================
+
+CRtspConnection::CRtspConnection(CRtspServer *aServer, SOCKET aClient) : LinkedListElement(aServer->getConnectionsListHead()),
+                                                                          m_Client(aClient),
+                                                                          m_Server(aServer)
+{
+    m_Streamer = aServer->getLiveStreamer();
+    m_OwnStreamer = (m_Streamer == NULL);
+    if (m_OwnStreamer)
+        m_Streamer = aServer->createStreamer();
+    m_Session = m_Streamer->addSession(aClient);
+    m_FramePeriodNs = 1000000000ULL / aServer->getFps();
+    m_WantWrite = false;
+}
+
+CRtspConnection::~CRtspConnection()
+{
+    delete m_Session; // closes its socket
+    if (m_OwnStreamer)
+        delete m_Streamer;
+}
+
+void CRtspConnection::onEvent(uint32_t events)
+{
+    // level triggered: the socket is readable (or hung up), so this read never blocks
+    bool wasStreaming = m_Session->m_streaming;
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+        m_Session->handleRequests(0);
+
+    // zerocopy completions wait in the socket error queue and raise EPOLLERR as well
+    bool failed = (events & EPOLLERR) && !m_Session->getTcpQueue().reap(m_Client);
+
+    // a TCP viewer's socket took what it could not before
+    failed = failed || ((events & EPOLLOUT) && !m_Streamer->flushTcp(m_Session));
+
+    if (m_Session->m_stopped || failed || (events & EPOLLHUP))
+    {
+        m_Server->closeConnection(this);
+        return;
+    }
+    updateWriteInterest();
+
+    // VOD: PLAY starts our frame clock, the first frame goes out right away
+    if (m_OwnStreamer && m_Session->m_streaming && !isArmed())
+        m_Server->getWheel()->add(this, monotonicNs());
+
+    // receiver reports come in on the streamer's RTCP socket from PLAY on
+    if (m_Session->m_streaming && !wasStreaming && !m_Session->isTcpTransport())
+        m_Streamer->watchRtcp(m_Server->getLoop());
+
+    // live: PLAY mid-GOP starts on the cached GOP, if there is one
+    if (!m_OwnStreamer && m_Session->m_streaming && !wasStreaming)
+    {
+        m_Streamer->primeSession(m_Session);
+        m_Server->armPacer();
+    }
+}
+
+void CRtspConnection::updateWriteInterest()
+{
+    bool want = m_Session->getTcpQueue().wantsWrite();
+    if (want == m_WantWrite)
+        return;
+
+    if (m_Server->getLoop()->modify(m_Client, EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0), this))
+        m_WantWrite = want;
+}
+
+/**
+   Frame clock of a VOD connection: send the next access unit and re-arm for the one after, on
+   absolute deadlines. A clock that fell behind fires again right away until it caught up, unless
+   it is more than RTSP_MAX_CATCHUP_FRAMES behind; then it starts over from now.
+ */
+void CRtspConnection::onTimer(uint64_t nowNs)
+{
+    if (!m_Session->m_streaming || m_Session->m_stopped)
+        return; // paused, the next PLAY restarts the clock
+
+    m_Streamer->streamImage((uint32_t)(nowNs / 1000000));
+
+    uint64_t deadline = getDeadline() + m_FramePeriodNs;
+    if (nowNs > deadline + RTSP_MAX_CATCHUP_FRAMES * m_FramePeriodNs)
+        deadline = nowNs + m_FramePeriodNs;
+    m_Server->getWheel()->add(this, deadline);
+}
+
+//===========================================================
+
+void CServerTimer::onTimer(uint64_t expirations)
+{
+    (m_Server->*m_Callback)(expirations);
+}
+
+//===========================================================
+
+void CPaceTimer::onTimer()
+{
+    m_Server->onPaceTick();
+}
+
+//===========================================================
+
+void CServerWheel::onBatch(size_t fired)
+{
+    m_Server->onFrameBatch(fired);
+}
+
+//===========================================================
+
+void initRtspServerConfig(RtspServerConfig *config)
+{
+    config->port = 554;
+    config->fps = 30;
+    config->reusePort = false;
+    config->live = false;
+    config->statsPeriodSec = 0;
+    config->txFlags = 0;
+    config->paceSpreadPercent = 0;
+    config->paceKbps = 0;
+    config->paceSmoothFrames = 0;
+    config->gopBurstSpeed = 0;
+}
+
+CRtspServer::CRtspServer(const uint8_t *stream, int64_t stream_len, const CNalIndex *index, const RtspServerConfig &config) : m_Config(config),
+                                                                                                 m_Clock(this, &CRtspServer::onMediaTick),
+                                                                                                 m_StatsTimer(this, &CRtspServer::onStatsTick),
+                                                                                                 m_RtcpTimer(this, &CRtspServer::onRtcpTick),
+                                                                                                 m_PaceTimer(this),
+                                                                                                 m_Wheel(this, monotonicNs()),
+                                                                                                 m_Connections()
+{
+    memset(&m_LastStats, 0, sizeof(m_LastStats));
+    m_LastRingFailed = 0;
+    m_LastRingFailedBytes = 0;
+    m_MasterSocket = NULLSOCKET;
+    m_Stream = stream;
+    m_StreamLen = stream_len;
+    m_Index = index;
+    m_Responses = NULL;
+    m_LiveStreamer = m_Config.live ? createStreamer() : NULL;
+}
+
+SimStreamer *CRtspServer::createStreamer()
+{
+    SimStreamer *streamer = new SimStreamer(m_Stream, m_StreamLen, m_Index, m_Config.fps);
+    streamer->setTxFlags(m_Config.txFlags);
+    streamer->setRing(&m_Ring);
+    // all our streamers play the same stream, they share its responses
+    if (!m_Responses)
+        m_Responses = new CRtspResponses(streamer->buildSdp());
+    streamer->setResponses(m_Responses);
+    streamer->setPacing(1000000000ULL / m_Config.fps, m_Config.paceSpreadPercent, m_Config.paceKbps,
+                        m_Config.paceSmoothFrames);
+    return streamer;
+}
+
+CRtspServer::~CRtspServer()
+{
+    while (m_Connections.NotEmpty())
+        closeConnection(static_cast<CRtspConnection *>(m_Connections.m_Next));
+
+    m_Clock.stop();
+    m_StatsTimer.stop();
+    m_RtcpTimer.stop();
+    m_PaceTimer.close();
+    m_Wheel.close();
+    if (m_MasterSocket != NULLSOCKET)
+    {
+        m_Loop.remove(m_MasterSocket, this);
+        closesocket(m_MasterSocket);
+    }
+    delete m_LiveStreamer;
+    delete m_Responses;
+}
+
+bool CRtspServer::Init()
+{
+    if (!m_Loop.isValid())
+        return false;
+
+    sockaddr_in ServerAddr; // server address parameters
+    ServerAddr.sin_family = AF_INET;
+    ServerAddr.sin_addr.s_addr = INADDR_ANY;
+    ServerAddr.sin_port = htons(m_Config.port);
+    m_MasterSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_MasterSocket < 0)
+    {
+        m_MasterSocket = NULLSOCKET;
+        return false;
+    }
+
+    int enable = 1;
+    if (setsockopt(m_MasterSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+    {
+        printf("setsockopt(SO_REUSEADDR) failed\n");
+        return false;
+    }
+    if (m_Config.reusePort && setsockopt(m_MasterSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) < 0)
+    {
+        printf("setsockopt(SO_REUSEPORT) failed\n");
+        return false;
+    }
+
+    // bind our master socket to the RTSP port and listen for client connections
+    if (bind(m_MasterSocket, (sockaddr *)&ServerAddr, sizeof(ServerAddr)) != 0)
+    {
+        printf("error can't bind port errno=%d\n", errno);
+        return false;
+    }
+
+    if (listen(m_MasterSocket, SOMAXCONN) != 0)
+        return false;
+
+    if (!m_Loop.add(m_MasterSocket, EPOLLIN, this))
+        return false;
+
+    if (usesPaceTimer() && !m_PaceTimer.init(&m_Loop))
+        return false;
+    if (m_LiveStreamer && m_Config.gopBurstSpeed > 0)
+        m_LiveStreamer->setGopCache(1000000000ULL / m_Config.fps, m_Config.gopBurstSpeed);
+
+    if (m_Config.statsPeriodSec > 0 && !m_StatsTimer.start(&m_Loop, m_Config.statsPeriodSec * 1000000000ULL))
+        return false;
+    if (!m_RtcpTimer.start(&m_Loop, RTSP_RTCP_TICK_MS * 1000000ULL))
+        return false;
+
+    // without io_uring the streamers stay on sendmmsg/sendmsg
+    if ((m_Config.txFlags & RTP_TX_IO_URING) && m_Ring.init(&m_Loop) && m_LiveStreamer)
+        m_LiveStreamer->setRing(&m_Ring);
+
+    if (m_LiveStreamer)
+        return m_Clock.start(&m_Loop, 1000000000ULL / m_Config.fps);
+    return m_Wheel.init(&m_Loop);
+}
+
+void CRtspServer::onEvent(uint32_t events)
+{
+    acceptClients();
+}
+
+void CRtspServer::acceptClients()
+{
+    for (;;)
+    {
+        sockaddr_in ClientAddr; // address parameters of a new RTSP client
+        socklen_t ClientAddrLen = sizeof(ClientAddr);
+        SOCKET ClientSocket = accept4(m_MasterSocket, (struct sockaddr *)&ClientAddr, &ClientAddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (ClientSocket < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                printf("accept failed errno=%d\n", errno);
+            return;
+        }
+
+        printf("Client connected. Client address: %s\r\n", inet_ntoa(ClientAddr.sin_addr));
+
+        // non-blocking: a client that does not read never holds up the loop, what it does not take waits in its queue
+        CRtspConnection *connection = new CRtspConnection(this, ClientSocket);
+        if (!m_Loop.add(ClientSocket, EPOLLIN | EPOLLRDHUP, connection))
+        {
+            delete connection;
+            continue;
+        }
+    }
+}
+
+void CRtspServer::closeConnection(CRtspConnection *aConnection)
+{
+    printf("End the Session\n");
+    m_Loop.remove(aConnection->m_Client, aConnection);
+    delete aConnection; // unlinks itself from m_Connections
+}
+
+/**
+   Live media clock: every frame period the live stream gets its next access unit, whether anybody
+   watches or not. If we were late for some ticks, the missed frames are sent right away (up to
+   RTSP_MAX_CATCHUP_FRAMES), so the stream keeps up with the wall clock.
+ */
+void CRtspServer::onMediaTick(uint64_t expirations)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint32_t curMsec = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    if (expirations > RTSP_MAX_CATCHUP_FRAMES)
+        expirations = RTSP_MAX_CATCHUP_FRAMES;
+
+    for (uint64_t frame = 0; frame < expirations; ++frame)
+        m_LiveStreamer->streamImage(curMsec);
+    armPacer();
+    watchTcpBacklogs();
+}
+
+/**
+   The VOD frame clocks due in one tick have fired, all their access units went out (or were queued).
+ */
+void CRtspServer::onFrameBatch(size_t frames)
+{
+    armPacer();
+    watchTcpBacklogs();
+}
+
+/**
+   Send the paced packets that are due now and wait for the next ones.
+ */
+void CRtspServer::onPaceTick()
+{
+    if (m_LiveStreamer)
+    {
+        m_LiveStreamer->sendPacedPackets();
+        m_LiveStreamer->sendPrimingPackets();
+    }
+    for (LinkedListElement *element = m_Connections.m_Next; !m_LiveStreamer && element != &m_Connections; element = element->m_Next)
+        static_cast<CRtspConnection *>(element)->m_Streamer->sendPacedPackets();
+    armPacer();
+    watchTcpBacklogs();
+}
+
+bool CRtspServer::usesPaceTimer()
+{
+    return m_Config.paceSpreadPercent > 0 || m_Config.paceKbps > 0 || m_Config.paceSmoothFrames > 0 ||
+           (m_LiveStreamer && m_Config.gopBurstSpeed > 0);
+}
+
+// wake up for the earliest paced or priming packet of all our streamers
+void CRtspServer::armPacer()
+{
+    if (!usesPaceTimer())
+        return;
+
+    uint64_t next = 0;
+    if (m_LiveStreamer)
+    {
+        next = m_LiveStreamer->nextPacedDue();
+        uint64_t priming = m_LiveStreamer->nextPrimingDue();
+        if (priming && (!next || priming < next))
+            next = priming;
+    }
+    for (LinkedListElement *element = m_Connections.m_Next; !m_LiveStreamer && element != &m_Connections; element = element->m_Next)
+    {
+        uint64_t due = static_cast<CRtspConnection *>(element)->m_Streamer->nextPacedDue();
+        if (due && (!next || due < next))
+            next = due;
+    }
+
+    if (next)
+        m_PaceTimer.arm(next);
+    else
+        m_PaceTimer.disarm();
+}
+
+// TCP viewers whose socket did not take everything get flushed when it is writable again
+void CRtspServer::watchTcpBacklogs()
+{
+    for (LinkedListElement *element = m_Connections.m_Next; element != &m_Connections; element = element->m_Next)
+        static_cast<CRtspConnection *>(element)->updateWriteInterest();
+}
+
+static void addStats(RtpSendStats &total, const RtpSendStats &stats)
+{
+    total.frames += stats.frames;
+    total.packets += stats.packets;
+    total.bytes += stats.bytes;
+    total.syscalls += stats.syscalls;
+    total.queued += stats.queued;
+    total.queueDelayNs += stats.queueDelayNs;
+    total.dropped += stats.dropped;
+    total.failed += stats.failed;
+    if (stats.maxQueueDelayNs > total.maxQueueDelayNs)
+        total.maxQueueDelayNs = stats.maxQueueDelayNs;
+}
+
+/**
+   Send the RTCP sender reports that are due, of all our streamers.
+ */
+void CRtspServer::onRtcpTick(uint64_t expirations)
+{
+    if (m_LiveStreamer)
+        m_LiveStreamer->sendSenderReports();
+    for (LinkedListElement *element = m_Connections.m_Next; !m_LiveStreamer && element != &m_Connections; element = element->m_Next)
+        static_cast<CRtspConnection *>(element)->m_Streamer->sendSenderReports();
+    watchTcpBacklogs();
+}
+
+// delivery health as the viewers' receiver reports tell it
+void CRtspServer::reportReceivers()
+{
+    unsigned viewers = 0, reporting = 0, withRtt = 0;
+    double lossSum = 0, lossMax = 0;
+    uint32_t jitterMax = 0, rttMax = 0;
+    int64_t lostTotal = 0;
+    uint64_t rttSum = 0;
+    for (LinkedListElement *element = m_Connections.m_Next; element != &m_Connections; element = element->m_Next)
+    {
+        CRtspSession *session = static_cast<CRtspConnection *>(element)->m_Session;
+        if (!session->m_streaming)
+            continue;
+        ++viewers;
+        const RtcpReceiverStats &receiver = session->getReceiverStats();
+        if (!receiver.reports)
+            continue;
+        ++reporting;
+        double loss = receiver.fractionLost / 256.0;
+        lossSum += loss;
+        if (loss > lossMax)
+            lossMax = loss;
+        lostTotal += receiver.cumulativeLost;
+        if (receiver.jitter > jitterMax)
+            jitterMax = receiver.jitter;
+        if (receiver.rttUs)
+        {
+            ++withRtt;
+            rttSum += receiver.rttUs;
+            if (receiver.rttUs > rttMax)
+                rttMax = receiver.rttUs;
+        }
+    }
+    if (!viewers)
+        return;
+
+    printf("receivers: %u of %u reporting, loss avg %.1f%% max %.1f%%, %lld lost, jitter max %.2f ms, rtt avg %.2f ms max %.2f ms\n",
+           reporting, viewers, reporting ? lossSum * 100 / reporting : 0.0, lossMax * 100, (long long)lostTotal,
+           jitterMax / 90.0, withRtt ? rttSum / 1000.0 / withRtt : 0.0, rttMax / 1000.0);
+}
+
+/**
+   Report what our streamers sent since the last report.
+ */
+void CRtspServer::onStatsTick(uint64_t expirations)
+{
+    RtpSendStats total;
+    memset(&total, 0, sizeof(total));
+
+    if (m_LiveStreamer)
+        addStats(total, m_LiveStreamer->getStats());
+    for (LinkedListElement *element = m_Connections.m_Next; !m_LiveStreamer && element != &m_Connections; element = element->m_Next)
+        addStats(total, static_cast<CRtspConnection *>(element)->m_Streamer->getStats());
+
+    // closed VOD connections take their counters with them, never report negative rates
+    if (total.packets < m_LastStats.packets || total.syscalls < m_LastStats.syscalls || total.frames < m_LastStats.frames ||
+        total.queued < m_LastStats.queued || total.queueDelayNs < m_LastStats.queueDelayNs || total.dropped < m_LastStats.dropped ||
+        total.failed < m_LastStats.failed)
+        m_LastStats = total;
+
+    uint64_t frames = total.frames - m_LastStats.frames;
+    uint64_t packets = total.packets - m_LastStats.packets;
+    uint64_t syscalls = total.syscalls - m_LastStats.syscalls;
+    uint64_t bytes = total.bytes - m_LastStats.bytes;
+    uint64_t queued = total.queued - m_LastStats.queued;
+    uint64_t queueDelayNs = total.queueDelayNs - m_LastStats.queueDelayNs;
+    uint64_t dropped = total.dropped - m_LastStats.dropped;
+    uint64_t failed = total.failed - m_LastStats.failed;
+
+    // the streamers count ring sends when queued, take back the ones that completed with an error
+    uint64_t ringFailed = m_Ring.getFailed() - m_LastRingFailed;
+    uint64_t ringFailedBytes = m_Ring.getFailedBytes() - m_LastRingFailedBytes;
+    m_LastRingFailed = m_Ring.getFailed();
+    m_LastRingFailedBytes = m_Ring.getFailedBytes();
+    packets -= ringFailed < packets ? ringFailed : packets;
+    bytes -= ringFailedBytes < bytes ? ringFailedBytes : bytes;
+    failed += ringFailed;
+    printf("stats: %llu pkts/s %llu kbit/s %llu syscalls/s %.1f pkts/frame %.1f syscalls/frame"
+           " queue delay avg %.2f ms max %.2f ms tcp dropped %llu pkts/s udp failed %llu pkts/s\n",
+           (unsigned long long)(packets / m_Config.statsPeriodSec),
+           (unsigned long long)(bytes * 8 / 1000 / m_Config.statsPeriodSec),
+           (unsigned long long)(syscalls / m_Config.statsPeriodSec),
+           frames ? (double)packets / frames : 0.0,
+           frames ? (double)syscalls / frames : 0.0,
+           queued ? (double)queueDelayNs / queued / 1000000.0 : 0.0,
+           (double)total.maxQueueDelayNs / 1000000.0,
+           (unsigned long long)(dropped / m_Config.statsPeriodSec),
+           (unsigned long long)(failed / m_Config.statsPeriodSec));
+
+    m_LastStats = total;
+
+    reportReceivers();
+
+    // the pool is shared by all workers of the process
+    RtpPacketPoolStats pool;
+    rtpPacketPoolGetStats(&pool);
+    printf("packet pool: %llu of %llu packets in use, high water %llu, %d arenas%s\n", (unsigned long long)pool.inUse,
+           (unsigned long long)pool.capacity, (unsigned long long)pool.highWater, pool.arenas, pool.hugepages ? " on hugepages" : "");
+
+    // the maximum is per report
+    if (m_LiveStreamer)
+        m_LiveStreamer->clearMaxQueueDelay();
+    for (LinkedListElement *element = m_Connections.m_Next; !m_LiveStreamer && element != &m_Connections; element = element->m_Next)
+        static_cast<CRtspConnection *>(element)->m_Streamer->clearMaxQueueDelay();
+}
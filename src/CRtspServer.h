@@ -0,0 +1,175 @@
+#pragma once
+
+#include "platglue.h"
+#include "CEventLoop.h"
+#include "CTimingWheel.h"
+#include "LinkedListElement.h"
+#include "CStreamer.h"
+#include "CNalIndex.h"
+
+#define RTSP_MAX_CATCHUP_FRAMES 4 // frames sent at once when the media clock was late
+#define RTSP_RTCP_TICK_MS 250      // sender reports that are due go out on this tick
+
+class CRtspServer;
+class CRtspSession;
+class SimStreamer;
+
+/**
+   One accepted RTSP client in the event driven server: its session and the streamer feeding it.
+   In VOD mode the connection is also the frame clock of its stream, a timer on the server's wheel.
+ */
+class CRtspConnection : public CEventHandler, public LinkedListElement, public CWheelTimer
+{
+public:
+    CRtspConnection(CRtspServer *aServer, SOCKET aClient);
+    ~CRtspConnection();
+
+    virtual void onEvent(uint32_t events);
+    virtual void onTimer(uint64_t nowNs); // the next frame is due
+    void updateWriteInterest();           // wait for EPOLLOUT while the TCP queue holds data
+
+    SimStreamer *m_Streamer;
+    CRtspSession *m_Session;
+    SOCKET m_Client;
+
+private:
+    CRtspServer *m_Server;
+    bool m_OwnStreamer; // VOD: a streamer with its own file cursor per connection
+    uint64_t m_FramePeriodNs;
+    bool m_WantWrite; // EPOLLOUT is in our event mask
+};
+
+/**
+   timerfd based timer calling back into a CRtspServer (media clock, statistics)
+ */
+class CServerTimer : public CPeriodicTimer
+{
+public:
+    typedef void (CRtspServer::*Callback)(uint64_t expirations);
+
+    CServerTimer(CRtspServer *aServer, Callback aCallback) : m_Server(aServer), m_Callback(aCallback) {}
+
+    virtual void onTimer(uint64_t expirations);
+
+private:
+    CRtspServer *m_Server;
+    Callback m_Callback;
+};
+
+/**
+   releases the paced packets of a CRtspServer's streamers when they are due, and the cached GOP
+   to the viewers being primed from it
+ */
+class CPaceTimer : public CDeadlineTimer
+{
+public:
+    CPaceTimer(CRtspServer *aServer) : m_Server(aServer) {}
+
+    virtual void onTimer();
+
+private:
+    CRtspServer *m_Server;
+};
+
+/**
+   the frame clocks of a CRtspServer's VOD connections
+ */
+class CServerWheel : public CTimingWheel
+{
+public:
+    CServerWheel(CRtspServer *aServer, uint64_t nowNs) : CTimingWheel(nowNs), m_Server(aServer) {}
+
+    virtual void onBatch(size_t fired);
+
+private:
+    CRtspServer *m_Server;
+};
+
+/**
+   settings of a CRtspServer
+ */
+struct RtspServerConfig
+{
+    IPPORT port;        // RTSP port to listen on
+    int fps;            // media clock rate
+    bool reusePort;     // SO_REUSEPORT listener, one server per worker thread
+    bool live;          // all connections share one streamer
+    int statsPeriodSec; // seconds between transmit statistics, 0 = off
+    int txFlags;        // RTP_TX_xxx transmit options of our streamers
+    int paceSpreadPercent; // spread each access unit over this part of the frame interval, 0 = no pacing
+    int paceKbps;          // but send paced streams at least at this rate, 0 = no minimum
+    int paceSmoothFrames;  // send access units up to this many frames early to flatten the rate, 0 = no smoothing
+    int gopBurstSpeed;     // live: viewers joining mid-GOP get the cached GOP at this many times real time, 0 = no GOP cache
+};
+
+void initRtspServerConfig(RtspServerConfig *config);
+
+/**
+   Event driven RTSP server: a single epoll loop owns the listen socket, all session sockets
+   and the media clocks, so one process serves many (mostly idle) clients without forking
+   or polling.
+
+   With config.reusePort several servers (one per worker thread) bind the same port and the kernel
+   spreads incoming connections over them. Servers share nothing but the read only stream
+   and its NAL index.
+
+   In live mode all connections subscribe to one shared streamer, so every frame is packetized
+   once per server regardless of the number of viewers, clocked by a timerfd. Otherwise each
+   connection plays the file from its start with a streamer of its own, clocked from its PLAY on
+   by a timing wheel that serves any number of stream clocks with one timerfd.
+ */
+class CRtspServer : public CEventHandler
+{
+public:
+    CRtspServer(const uint8_t *stream, int64_t stream_len, const CNalIndex *index, const RtspServerConfig &config);
+    ~CRtspServer();
+
+    bool Init();
+    void Run() { m_Loop.run(); }
+
+    CEventLoop *getLoop() { return &m_Loop; }
+    CTimingWheel *getWheel() { return &m_Wheel; }
+    int getFps() { return m_Config.fps; }
+    const uint8_t *getStream() { return m_Stream; }
+    int64_t getStreamLen() { return m_StreamLen; }
+    const CNalIndex *getIndex() { return m_Index; }
+    LinkedListElement *getConnectionsListHead() { return &m_Connections; }
+    SimStreamer *getLiveStreamer() { return m_LiveStreamer; } // NULL if not in live mode
+    SimStreamer *createStreamer();
+
+    void closeConnection(CRtspConnection *aConnection);
+
+    virtual void onEvent(uint32_t events); // listen socket is readable
+    void onMediaTick(uint64_t expirations);
+    void onStatsTick(uint64_t expirations);
+    void onRtcpTick(uint64_t expirations);
+    void onPaceTick();
+    void onFrameBatch(size_t frames);
+    void armPacer(); // wake up for the next paced or priming packet
+
+private:
+    void acceptClients();
+    bool usesPaceTimer();
+    void watchTcpBacklogs();
+    void reportReceivers();
+
+    CEventLoop m_Loop;
+    CIoUring m_Ring; // shared transmit backend of our streamers with RTP_TX_IO_URING
+    SOCKET m_MasterSocket;
+    RtspServerConfig m_Config;
+    CServerTimer m_Clock;
+    CServerTimer m_StatsTimer;
+    CServerTimer m_RtcpTimer;
+    CPaceTimer m_PaceTimer;
+    CServerWheel m_Wheel;
+    RtpSendStats m_LastStats; // at the last report
+    uint64_t m_LastRingFailed, m_LastRingFailedBytes; // m_Ring's failed sends at the last report
+
+    const uint8_t *m_Stream;
+    int64_t m_StreamLen;
+    const CNalIndex *m_Index;
+    SimStreamer *m_LiveStreamer;
+    CRtspResponses *m_Responses; // of our stream, shared by the streamers
+
+    LinkedListElement m_Connections;
+};
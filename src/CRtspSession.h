@@ -1,80 +1,106 @@
-#pragma once
-
-#include "LinkedListElement.h"
-#include "CStreamer.h"
-#include "platglue.h"
-
-// supported command types
-enum RTSP_CMD_TYPES
-{
-    RTSP_OPTIONS,
-    RTSP_DESCRIBE,
-    RTSP_SETUP,
-    RTSP_PLAY,
-    RTSP_TEARDOWN,
-    RTSP_UNKNOWN
-};
-
-#define RTSP_BUFFER_SIZE       500  //10000 -> 500 MDAOOD  // for incoming requests, and outgoing responses
-#define RTSP_PARAM_STRING_MAX  50   //200 -> 50 MDAOOD
-#define MAX_HOSTNAME_LEN       56   //256 -> 56 MDAOOD
-
-class CRtspSession : public LinkedListElement
-{
-public:
-    CRtspSession( SOCKET aRtspClient, CStreamer * aStreamer );
-    ~CRtspSession();
-
-    RTSP_CMD_TYPES Handle_RtspRequest( char *aRequest, unsigned aRequestSize );
-    int            GetStreamID();
-
-    /**
-       Read from our socket, parsing commands as possible.
-
-       return false if the read timed out
-     */
-    bool handleRequests(uint32_t readTimeoutMs);
-
-    bool m_streaming;
-    bool m_stopped;
-
-    void InitTransport(u_short aRtpPort, u_short aRtcpPort);
-
-    bool isTcpTransport() { return m_TcpTransport; }
-    SOCKET& getClient() { return m_RtspClient; }
-    
-    uint16_t getRtpClientPort() { return m_RtpClientPort; }
-
-    bool debug; /// set to true to get a load of output
-private:
-    void newCommandInit();
-    bool ParseRtspRequest( char * aRequest, unsigned aRequestSize );
-    char const * DateHeader();
-
-    // RTSP request command handlers
-    void Handle_RtspOPTION();
-    void Handle_RtspDESCRIBE();
-    void Handle_RtspSETUP();
-    void Handle_RtspPLAY();
-
-    // global session state parameters
-    int m_RtspSessionID;
-    SOCKET m_Client;
-    SOCKET m_RtspClient;                                      /// RTSP socket of that session
-    int m_StreamID;                                           /// number of simulated stream of that session
-    IPPORT m_ClientRTPPort;                                   /// client port for UDP based RTP transport
-    IPPORT m_ClientRTCPPort;                                  /// client port for UDP based RTCP transport
-    bool m_TcpTransport;                                      /// if Tcp based streaming was activated
-    CStreamer    * m_Streamer;                                /// the UDP or TCP streamer of that session
-
-    // parameters of the last received RTSP request
-    RTSP_CMD_TYPES m_RtspCmdType;                             /// command type (if any) of the current request
-    char m_CommandPresentationPart[RTSP_PARAM_STRING_MAX];        /// stream name pre suffix
-    char m_CommandStreamPart[RTSP_PARAM_STRING_MAX];              /// stream name suffix
-    char m_CommandHostPort[MAX_HOSTNAME_LEN];                     /// host:port part of the URL
-    unsigned m_CSeq;                                          /// RTSP command sequence number
-    unsigned m_ContentLength;                                 /// SDP string size
-
-    uint16_t m_RtpClientPort;      // RTP receiver port on client (in host byte order!)
-    uint16_t m_RtcpClientPort;     // RTCP receiver port on client (in host byte order!)
-};
+#pragma once
+
+#include "LinkedListElement.h"
+#include "CStreamer.h"
+#include "CTcpSendQueue.h"
+#include "CRtspParser.h"
+#include "Rtcp.h"
+#include "platglue.h"
+
+#define RTSP_BUFFER_SIZE       2048 // incoming requests, a few pipelined ones with their bodies
+#define RTSP_RESPONSE_SIZE     2048 // largest answer is DESCRIBE with its SDP (RTSP_SDP_MAX)
+#define RTSP_RESPONSE_BACKLOG  (64 * 1024) // unread responses at which we give up on a client
+#define RTSP_RTCP_CHANNEL      1    // interleaved channel of RTCP over RTSP, we answer SETUP with interleaved=0-1
+
+class CRtspSession : public LinkedListElement
+{
+public:
+    CRtspSession( SOCKET aRtspClient, CStreamer * aStreamer );
+    ~CRtspSession();
+
+    RTSP_CMD_TYPES Handle_RtspRequest( const RtspRequest &aRequest );
+    int            GetStreamID();
+
+    /**
+       Read from our socket and serve every complete request in what arrived.
+
+       return false if the read timed out
+     */
+    bool handleRequests(uint32_t readTimeoutMs);
+
+    bool m_streaming;
+    bool m_stopped;
+
+    void InitTransport(u_short aRtpPort, u_short aRtcpPort);
+
+    bool isTcpTransport() { return m_TcpTransport; }
+    SOCKET& getClient() { return m_RtspClient; }
+    
+    uint16_t getRtpClientPort() { return m_RtpClientPort; }
+    uint16_t getRtcpClientPort() { return m_RtcpClientPort; }
+    const sockaddr_in *getRtpDest() { return &m_RtpDest; } // resolved at SETUP
+    UDPSOCKET getRtpSocket() { return m_RtpSocket; }        // connected to m_RtpDest, 0 = use the streamer's
+    CTcpSendQueue &getTcpQueue() { return m_TcpQueue; }     // responses and RTP over RTSP packets the socket did not take yet
+    RtpPrimingQueue &getPriming() { return m_Priming; }      // cached GOP to catch up on before the live packets
+
+    // this viewer's view of the shared stream packets
+    uint32_t getSsrc() { return m_Ssrc; }
+    uint16_t getSeqOffset() { return m_SeqOffset; }
+    uint32_t getTimestampOffset() { return m_TimestampOffset; }
+
+    // RTCP: what we sent this viewer (for its sender reports) and what it reported back
+    void onRtpSent(const RtpPacket *pkt) { ++m_RtpPacketsSent; m_RtpOctetsSent += pkt->len - RTP_HEADER_SIZE; }
+    uint32_t getRtpPacketsSent() { return m_RtpPacketsSent; }
+    uint32_t getRtpOctetsSent() { return m_RtpOctetsSent; }
+    uint64_t getRtcpDue() { return m_RtcpDue; }
+    void setRtcpDue(uint64_t aDueNs) { m_RtcpDue = aDueNs; }
+    void onReceiverReport(const RtcpReportBlock &aBlock, uint64_t aArrivalNtp) { rtcpApplyReport(&m_Receiver, &aBlock, aArrivalNtp); }
+    const RtcpReceiverStats &getReceiverStats() { return m_Receiver; }
+
+    bool debug; /// set to true to get a load of output
+private:
+    void InitRtpDest();
+    void ResponseArgs(RtspResponseArgs *aArgs);
+    void SendResponse(const char *aResponse, size_t aLength);
+    void SendError(const char *aStatus);
+
+    // RTSP request command handlers
+    void Handle_RtspOPTION();
+    void Handle_RtspDESCRIBE(const RtspRequest &aRequest);
+    void Handle_RtspSETUP(const RtspRequest &aRequest);
+    void Handle_RtspPLAY(const RtspRequest &aRequest);
+
+    // global session state parameters
+    int m_RtspSessionID;
+    SOCKET m_Client;
+    SOCKET m_RtspClient;                                      /// RTSP socket of that session
+    int m_StreamID;                                           /// number of simulated stream of that session
+    IPPORT m_ClientRTPPort;                                   /// client port for UDP based RTP transport
+    IPPORT m_ClientRTCPPort;                                  /// client port for UDP based RTCP transport
+    bool m_TcpTransport;                                      /// if Tcp based streaming was activated
+    bool m_UdpTransport;                                      /// if we hold a reference on the streamer's UDP sockets
+    CStreamer    * m_Streamer;                                /// the UDP or TCP streamer of that session
+
+    unsigned m_CSeq;                                          /// RTSP command sequence number of the last request
+
+    uint16_t m_RtpClientPort;      // RTP receiver port on client (in host byte order!)
+    uint16_t m_RtcpClientPort;     // RTCP receiver port on client (in host byte order!)
+    sockaddr_in m_RtpDest;         // client address and RTP port, UDP transport
+    UDPSOCKET m_RtpSocket;         // our own socket, connect()ed to m_RtpDest (RTP_TX_UDP_CONNECTED)
+    CTcpSendQueue m_TcpQueue;      // TCP transport output waiting for the socket
+    RtpPrimingQueue m_Priming;     // live viewers that joined mid-GOP, see CStreamer::primeSession
+
+    uint32_t m_Ssrc;               // SSRC of our RTP stream
+    uint16_t m_SeqOffset;          // added to the stream's sequence numbers
+    uint32_t m_TimestampOffset;    // added to the stream's timestamps
+    uint32_t m_RtpPacketsSent;     // RTP packets sent to this viewer, for the sender reports
+    uint32_t m_RtpOctetsSent;      // and their payload octets
+    uint64_t m_RtcpDue;            // CLOCK_MONOTONIC ns the next sender report is due, 0 = none sent yet
+    RtcpReceiverStats m_Receiver;  // from the viewer's receiver reports
+
+    // per session buffers, so sessions may live on different threads
+    CRtspParser m_Parser;                                     /// requests are parsed in place in m_RecvBuf
+    unsigned m_RecvBufPos;                                    /// bytes in m_RecvBuf, the start of a request not complete yet
+    char m_RecvBuf[RTSP_BUFFER_SIZE];                         /// incoming requests
+    char m_Response[RTSP_RESPONSE_SIZE];                      /// outgoing response
+};
@@ -1,366 +1,1119 @@
-#include "CStreamer.h"
-#include "CRtspSession.h"
-#include "Utils.h"
-#include <stdio.h>
-
-CStreamer::CStreamer(u_short width, u_short height) : m_Clients()
-{
-    printf("Creating TSP streamer\n");
-    m_RtpServerPort = 0;
-    m_RtcpServerPort = 0;
-
-    m_SequenceNumber = 0;
-    m_Timestamp = 0;
-    m_SendIdx = 0;
-
-    m_RtpSocket = NULLSOCKET;
-    m_RtcpSocket = NULLSOCKET;
-
-    m_width = width;
-    m_height = height;
-    m_prevMsec = 0;
-
-    m_udpRefCount = 0;
-
-    debug = false;
-
-    m_URIHost = "127.0.0.1:554";
-    m_URIPresentation = "live";
-    m_URIStream = "1";
-}
-
-CStreamer::~CStreamer()
-{
-    LinkedListElement *element = m_Clients.m_Next;
-    CRtspSession *session = NULL;
-    while (element != &m_Clients)
-    {
-        session = static_cast<CRtspSession *>(element);
-        element = element->m_Next;
-        delete session;
-    }
-};
-
-CRtspSession *CStreamer::addSession(SOCKET aClient)
-{
-    // if ( debug ) printf("CStreamer::addSession\n");
-    CRtspSession *session = new CRtspSession(aClient, this); // our threads RTSP session and state
-    // we have it stored in m_Clients
-    session->debug = debug;
-    return session;
-}
-
-void CStreamer::setURI(String hostport, String pres, String stream) // set URI parts for sessions to use.
-{
-    m_URIHost = hostport;
-    m_URIPresentation = pres;
-    m_URIStream = stream;
-}
-int CStreamer::rtpSendData(RTPMuxContext *ctx, const uint8_t *buf, int len, int mark)
-{
-    // printf("rtpSendData\r\n");
-    // int res = 0;
-
-    /* build the RTP header */
-    /*
-     *
-     *    0                   1                   2                   3
-     *    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     *   |V=2|P|X|  CC   |M|     PT      |       sequence number         |
-     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     *   |                           timestamp                           |
-     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     *   |           synchronization source (SSRC) identifier            |
-     *   +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
-     *   |            contributing source (CSRC) identifiers             |
-     *   :                             ....                              :
-     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     *
-     **/
-    // Prepare the first 4 byte of the packet. This is the Rtp over Rtsp header in case of TCP based transport
-    ctx->cache[0] = '$'; // magic number
-    ctx->cache[1] = 0;   // number of multiplexed subchannel on RTPS connection - here the RTP channel
-    ctx->cache[2] = ((len + 12) & 0x0000FF00) >> 8;
-    ctx->cache[3] = ((len + 12) & 0x000000FF);
-    // Prepare the 12 byte RTP header
-    uint8_t *pos = &ctx->cache[4];
-    pos[0] = (RTP_VERSION << 6) & 0xff;                           // V P X CC
-    pos[1] = (uint8_t)((RTP_H264 & 0x7f) | ((mark & 0x01) << 7)); // M PayloadType
-    Load16(&pos[2], (uint16_t)ctx->seq);                          // Sequence number
-    Load32(&pos[4], ctx->timestamp);
-    Load32(&pos[8], ctx->ssrc);
-
-    /* copy payload data */
-    memcpy(&pos[12], buf, len);
-
-    IPADDRESS otherip;
-    IPPORT otherport;
-
-    // RTP marker bit must be set on last fragment
-    LinkedListElement *element = m_Clients.m_Next;
-    CRtspSession *session = NULL;
-    while (element != &m_Clients)
-    {
-        session = static_cast<CRtspSession *>(element);
-        if (session->m_streaming && !session->m_stopped)
-        {
-            if (session->isTcpTransport()) // RTP over RTSP - we send the buffer + 4 byte additional header
-            {
-                socketsend(session->getClient(), ctx->cache, (uint32_t)(len + 12 + 4));
-            }
-            else // UDP - we send just the buffer by skipping the 4 byte RTP over RTSP header
-            {
-                socketpeeraddr(session->getClient(), &otherip, &otherport);
-                udpsocketsend(m_RtpSocket, &ctx->cache[4], (uint32_t)(len + 12), otherip, session->getRtpClientPort());
-            }
-        }
-        element = element->m_Next;
-    }
-
-    // printf("rtpSendData cache [%d]: ", res);
-    // for (int i = 0; i < 20; ++i)
-    // {
-    //     printf("%.2X ", ctx->cache[i]);
-    // }
-    // printf("\n\n");
-
-    memset(ctx->cache, 0, RTP_PAYLOAD_MAX + 10);
-
-    ctx->buf_ptr = ctx->buf; // restore buf_ptr
-
-    ctx->seq = (ctx->seq + 1) & 0xffff;
-    return 0;
-}
-u_short CStreamer::GetRtpServerPort()
-{
-    return m_RtpServerPort;
-};
-
-u_short CStreamer::GetRtcpServerPort()
-{
-    return m_RtcpServerPort;
-};
-
-bool CStreamer::InitUdpTransport(void)
-{
-    if (m_udpRefCount != 0)
-    {
-        ++m_udpRefCount;
-        return true;
-    }
-
-    for (u_short P = 6970; P < 0xFFFE; P += 2)
-    {
-        m_RtpSocket = udpsocketcreate(P);
-        if (m_RtpSocket)
-        { // Rtp socket was bound successfully. Lets try to bind the consecutive Rtsp socket
-            m_RtcpSocket = udpsocketcreate(P + 1);
-            if (m_RtcpSocket)
-            {
-                m_RtpServerPort = P;
-                m_RtcpServerPort = P + 1;
-                break;
-            }
-            else
-            {
-                udpsocketclose(m_RtpSocket);
-                udpsocketclose(m_RtcpSocket);
-            };
-        }
-    };
-    ++m_udpRefCount;
-    return true;
-}
-
-void CStreamer::ReleaseUdpTransport(void)
-{
-    --m_udpRefCount;
-    if (m_udpRefCount == 0)
-    {
-        m_RtpServerPort = 0;
-        m_RtcpServerPort = 0;
-        udpsocketclose(m_RtpSocket);
-        udpsocketclose(m_RtcpSocket);
-
-        m_RtpSocket = NULLSOCKET;
-        m_RtcpSocket = NULLSOCKET;
-    }
-}
-
-/**
-   Call handleRequests on all sessions
- */
-bool CStreamer::handleRequests(uint32_t readTimeoutMs)
-{
-    bool retVal = true;
-    LinkedListElement *element = m_Clients.m_Next;
-    while (element != &m_Clients)
-    {
-        CRtspSession *session = static_cast<CRtspSession *>(element);
-        retVal &= session->handleRequests(readTimeoutMs);
-
-        element = element->m_Next;
-
-        if (session->m_stopped)
-        {
-            // remove session here, so we wont have to send to it
-            delete session;
-        }
-    }
-
-    return retVal;
-}
-
-#include <assert.h>
-/**
- * General Rulle :
- * Remove "00 00 00 01" from the original code NAL stream, add a tcp (12 Byte + 2Bytes(length)) or udp (12bits) header to the header, and then send it out.
- */
-
-void CStreamer::rtpSendNALH265(RTPMuxContext *ctx, const uint8_t *nal, int size, int last)
-{
-
-    // Single NAL Packet or Aggregation Packets
-    if (size <= RTP_PAYLOAD_MAX)
-    {
-
-        // Handle Aggregation Packets
-        // Multiple small NAL units are encapsulated into a single RTP packet to reduce RTP overhead
-        // Adding 4 bytes for Payload Header (2 bytes) + NAL Unit size (2 bytes)
-        if (ctx->aggregation && size + 4 <= RTP_PAYLOAD_MAX)
-        {
-
-            /*                       1                   2                   3
-             *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *  |   PayloadHdr (Type=48)        |   NALU 1 Size                 |
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *  |           NALU 1 HDR          |   NALU 1 Data                 |
-             *  |           ...                         ....                    |
-             *                  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *  |   ...         |      NALU 2 Size              | NALU 2 HDR    |
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *  |    NALU 2 HDR |   NALU 2 Data         ...                     |
-             *  |           ...                         ...                     |
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             * */
-
-            int buffered_size = static_cast<int>(ctx->buf_ptr - ctx->buf); // Calculate current buffer size
-
-            // If remaining buffer space is insufficient, send existing data
-            if (buffered_size && buffered_size + 2 + size > RTP_PAYLOAD_MAX)
-            {
-                rtpSendData(ctx, ctx->buf, buffered_size);
-                buffered_size = 0;
-            }
-            /*   PayloadHdr (Type=48)
-             *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 5
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *  |F|    Type   | LayerId   | TID |
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *      F       = 0
-             *      Type    = 48 (Aggregation Uint AU)
-             *      LayerId = 0
-             *      TID     = 1
-             */
-            // First entry in the aggregation packet
-            if (!buffered_size)
-            {
-                ctx->buf[0] = (48 << 1);
-                ctx->buf[1] = 1;
-                ctx->buf_ptr += 2;
-            }
-
-            // Add NALU Size, NALU Header, and NALU Data
-            Load16(ctx->buf_ptr, static_cast<uint16_t>(size)); // Load NAL size
-            ctx->buf_ptr += 2;
-            memcpy(ctx->buf_ptr, nal, size); // Copy NALU Header & Data
-            ctx->buf_ptr += size;
-
-            // If this is the last NAL, send the buffer
-            if (last == 1)
-            {
-                rtpSendData(ctx, ctx->buf, static_cast<int>(ctx->buf_ptr - ctx->buf));
-            }
-        }
-        // Single NAL Unit RTP Packet
-        else
-        {
-            // the bits are directly used as loads
-            /*
-             *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 5 7 0 1 2 3 4 5 6 . . .
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             *  |F|    Type   | LayerId   | TID | NAL unit payload data  ... |
-             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-             * */
-            rtpSendData(ctx, nal, size);
-        }
-    }
-    else // Fragmentation Unit
-    {
-        // If buffer has existing data, send it
-        if (ctx->buf_ptr > ctx->buf)
-        {
-            rtpSendData(ctx, ctx->buf, (int)(ctx->buf_ptr - ctx->buf));
-        }
-
-        uint8_t nalu_type = (nal[0] >> 1) & 0x3F;
-
-        /*                       1                   2                   3
-         *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-         *  |   PayloadHdr (Type=49)        |    FU header  |               |
-         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-         *  |   ...         |         FU payload                            |
-         *  |   ...                                 ...                     |
-         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-         */
-
-        /*
-         *   PayloadHdr (Type=49)
-         *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 5
-         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-         *  |F|    Type   | LayerId   | TID |
-         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-         *      F       = 0
-         *      Type    = 49 (fragmention uint FU)
-         *      LayerId = 0
-         *      TID     = 1
-         */
-
-        ctx->buf[0] = (49 << 1);
-        ctx->buf[1] = 1;
-
-        /* Create the FU header
-         *
-         *   0 1 2 3 4 5 6 7
-         *  +-+-+-+-+-+-+-+-+
-         *  |S|E|   FuType  |
-         *  +-+-+-+-+-+-+-+-+
-         * S start : Variable
-         * E End   : Variable
-         * FuType  :  nalu_type
-         */
-        // S = 1 (start fragment), E = 0 (not end), FuType = nalu_type
-        ctx->buf[2] = nalu_type;
-        ctx->buf[2] |= 1 << 7; // Set S=1 , E=0
-        nal += 2;              // Skip the original NAL header
-        size -= 2;
-        const uint8_t header_Size = 3; // sizeof(PayloadHdr) + sizeof(FU header)
-
-        // Fragment the NAL unit and send in multiple RTP packets if necessary
-        while (size + header_Size > RTP_PAYLOAD_MAX)
-        {
-            memcpy(&ctx->buf[header_Size], nal, static_cast<size_t>(RTP_PAYLOAD_MAX - header_Size));
-            rtpSendData(ctx, ctx->buf, RTP_PAYLOAD_MAX);
-            nal += RTP_PAYLOAD_MAX - header_Size;
-            size -= RTP_PAYLOAD_MAX - header_Size;
-            ctx->buf[2] &= 0x7f; // Clear S and E bits
-        }
-        // Final fragment, set E bit to 1
-        ctx->buf[2] |= 0x40; 
-        memcpy(&ctx->buf[header_Size], nal, size);
-        rtpSendData(ctx, ctx->buf, size + header_Size);
-    }
-}
\ No newline at end of file
+#include "CStreamer.h"
+#include "CRtspSession.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+CStreamer::CStreamer(u_short width, u_short height) : m_Clients()
+{
+    printf("Creating TSP streamer\n");
+    m_RtpServerPort = 0;
+    m_RtcpServerPort = 0;
+
+    m_SequenceNumber = 0;
+    m_Timestamp = 0;
+    m_SendIdx = 0;
+
+    m_RtpSocket = NULLSOCKET;
+    m_RtcpSocket = NULLSOCKET;
+
+    m_width = width;
+    m_height = height;
+    m_prevMsec = 0;
+
+    m_udpRefCount = 0;
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    m_TxFlags = 0;
+    m_Aggregate = NULL;
+    m_PacedHead = 0;
+    m_Ring = NULL;
+    m_Responses = NULL;
+    m_OwnResponses = NULL;
+    m_SdpVersion = 1;
+    m_GopSpeed = 0;
+    m_GopFrameNs = 0;
+    m_AuStart = true;
+    m_PrimingDue = 0;
+    m_RtcpHandler.streamer = this;
+    m_RtcpLoop = NULL;
+    m_RtcpWatched = 0;
+    m_ClockTimestamp = 0;
+    m_ClockNs = 0;
+    m_FrameNs = 0;
+
+    char host[64] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    m_Cname = host;
+
+    debug = false;
+
+    m_URIHost = "127.0.0.1:554";
+    m_URIPresentation = "live";
+    m_URIStream = "1";
+}
+
+CStreamer::~CStreamer()
+{
+    for (size_t i = 0; i < m_Packets.size(); ++i)
+        rtpPacketUnref(m_Packets[i]);
+    for (size_t i = m_PacedHead; i < m_Paced.size(); ++i)
+        rtpPacketUnref(m_Paced[i]);
+    rtpPacketUnref(m_Aggregate);
+    releaseGop();
+    delete m_OwnResponses;
+
+    LinkedListElement *element = m_Clients.m_Next;
+    CRtspSession *session = NULL;
+    while (element != &m_Clients)
+    {
+        session = static_cast<CRtspSession *>(element);
+        element = element->m_Next;
+        delete session;
+    }
+};
+
+CRtspSession *CStreamer::addSession(SOCKET aClient)
+{
+    // if ( debug ) printf("CStreamer::addSession\n");
+    CRtspSession *session = new CRtspSession(aClient, this); // our threads RTSP session and state
+    // we have it stored in m_Clients
+    session->debug = debug;
+    return session;
+}
+
+void CStreamer::setURI(String hostport, String pres, String stream) // set URI parts for sessions to use.
+{
+    m_URIHost = hostport;
+    m_URIPresentation = pres;
+    m_URIStream = stream;
+}
+RtpPacket *CStreamer::rtpNewPacket()
+{
+    return rtpPacketAlloc();
+}
+
+/**
+   Finish a packet: fill in the RTP (and RTP over RTSP) header and queue it for sendPackets().
+ */
+int CStreamer::rtpSendData(RTPMuxContext *ctx, RtpPacket *pkt, int mark)
+{
+    // printf("rtpSendData\r\n");
+
+    /* build the RTP header */
+    /*
+     *
+     *    0                   1                   2                   3
+     *    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *   |V=2|P|X|  CC   |M|     PT      |       sequence number         |
+     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *   |                           timestamp                           |
+     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *   |           synchronization source (SSRC) identifier            |
+     *   +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+     *   |            contributing source (CSRC) identifiers             |
+     *   :                             ....                              :
+     *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *
+     **/
+    // Prepare the first 4 byte of the packet. This is the Rtp over Rtsp header in case of TCP based transport
+    uint8_t *tcp = rtpPacketTcpHeader(pkt);
+    tcp[0] = '$'; // magic number
+    tcp[1] = 0;   // number of multiplexed subchannel on RTPS connection - here the RTP channel
+    tcp[2] = (pkt->len & 0x0000FF00) >> 8;
+    tcp[3] = (pkt->len & 0x000000FF);
+    // Prepare the 12 byte RTP header
+    uint8_t *pos = rtpPacketHeader(pkt);
+    pos[0] = (RTP_VERSION << 6) & 0xff;                           // V P X CC
+    pos[1] = (uint8_t)((RTP_H264 & 0x7f) | ((mark & 0x01) << 7)); // M PayloadType
+    Load16(&pos[2], (uint16_t)ctx->seq);                          // Sequence number
+    Load32(&pos[4], ctx->timestamp);
+    Load32(&pos[8], ctx->ssrc);
+
+    pkt->mark = mark;
+    pkt->seq = (uint16_t)ctx->seq;
+    pkt->timestamp = ctx->timestamp;
+    m_Packets.push_back(pkt);
+
+    ctx->seq = (ctx->seq + 1) & 0xffff;
+    return 0;
+}
+
+bool CStreamer::anyStreamingSessions()
+{
+    LinkedListElement *element = m_Clients.m_Next;
+    while (element != &m_Clients)
+    {
+        CRtspSession *session = static_cast<CRtspSession *>(element);
+        if (session->m_streaming && !session->m_stopped)
+            return true;
+        element = element->m_Next;
+    }
+    return false;
+}
+
+/**
+   Copy the RTP header of a shared packet and patch in the session's SSRC, sequence number and timestamp.
+ */
+static void rtpPatchHeader(uint8_t *hdr, RtpPacket *pkt, CRtspSession *session)
+{
+    memcpy(hdr, rtpPacketHeader(pkt), RTP_HEADER_SIZE);
+    Load16(&hdr[2], (uint16_t)(pkt->seq + session->getSeqOffset()));
+    Load32(&hdr[4], pkt->timestamp + session->getTimestampOffset());
+    Load32(&hdr[8], session->getSsrc());
+}
+
+static uint64_t monotonicNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+   Send the packets built since the last call (one access unit) to every playing session.
+
+   The packet buffers are shared, each session only gets its own SSRC, sequence number
+   and timestamp patched into a private copy of the header.
+
+   With pacing the packets are queued with departure times instead; the due ones go out right
+   away, the rest with later sendPacedPackets() calls. With RTP_TX_UDP_TXTIME the kernel does
+   that queueing: all packets are sent at once, UDP ones stamped with their departure time
+   (TCP viewers get the access unit right away and are paced by TCP itself).
+ */
+void CStreamer::sendPackets(int aheadFrames, const uint64_t *nextBytes, size_t next)
+{
+    if (m_Packets.empty())
+        return;
+    ++m_Stats.frames;
+
+    uint64_t now = monotonicNs();
+    for (size_t i = 0; i < m_Packets.size(); ++i)
+        m_Packets[i]->queued = now;
+
+    // the access unit is aheadFrames early: its timestamp is due then, the sender reports go by that
+    m_ClockTimestamp = m_Packets[0]->timestamp;
+    m_ClockNs = now + aheadFrames * m_FrameNs;
+
+    if (!m_Pacer.enabled())
+    {
+        transmit(m_Packets.data(), m_Packets.size(), now);
+        for (size_t i = 0; i < m_Packets.size(); ++i)
+            rtpPacketUnref(m_Packets[i]);
+        m_Packets.clear();
+        return;
+    }
+
+    m_Pacer.schedule(m_Packets.data(), m_Packets.size(), now, aheadFrames, nextBytes, next);
+    if (m_TxFlags & RTP_TX_UDP_TXTIME)
+    {
+        // the whole access unit goes to the kernel now, the fq qdisc sends each packet when it is due
+        transmit(m_Packets.data(), m_Packets.size(), now);
+        for (size_t i = 0; i < m_Packets.size(); ++i)
+            rtpPacketUnref(m_Packets[i]);
+        m_Packets.clear();
+        return;
+    }
+    m_Paced.insert(m_Paced.end(), m_Packets.begin(), m_Packets.end());
+    m_Packets.clear();
+    sendPacedPackets();
+}
+
+void CStreamer::setAccessUnitFlags(int flags)
+{
+    for (size_t i = 0; i < m_Packets.size(); ++i)
+        m_Packets[i]->flags = flags;
+}
+
+/**
+   Send the queued packets that are due, returns the departure time of the next one (0 = none left).
+ */
+uint64_t CStreamer::sendPacedPackets()
+{
+    uint64_t now = monotonicNs();
+    size_t due = m_PacedHead;
+    while (due < m_Paced.size() && m_Paced[due]->due <= now)
+        ++due;
+
+    if (due > m_PacedHead)
+    {
+        transmit(&m_Paced[m_PacedHead], due - m_PacedHead, now);
+        for (size_t i = m_PacedHead; i < due; ++i)
+            rtpPacketUnref(m_Paced[i]);
+        m_PacedHead = due;
+    }
+
+    if (m_PacedHead == m_Paced.size())
+    {
+        m_Paced.clear();
+        m_PacedHead = 0;
+        return 0;
+    }
+    return m_Paced[m_PacedHead]->due;
+}
+
+void CStreamer::setPacing(uint64_t frameIntervalNs, int spreadPercent, int targetKbps, int smoothFrames)
+{
+    m_FrameNs = frameIntervalNs;
+    m_Pacer.configure(frameIntervalNs, spreadPercent, targetKbps, smoothFrames);
+}
+
+/**
+   Hand count packets to every playing session and account for their time in our queue.
+   Sessions still being primed queue them behind the cached GOP.
+ */
+void CStreamer::transmit(RtpPacket *const *pkts, size_t count, uint64_t now)
+{
+    if (m_GopSpeed)
+        cacheGop(pkts, count);
+
+    LinkedListElement *element = m_Clients.m_Next;
+    CRtspSession *session = NULL;
+    while (element != &m_Clients)
+    {
+        session = static_cast<CRtspSession *>(element);
+        element = element->m_Next;
+        if (!session->m_streaming || session->m_stopped)
+            continue;
+
+        // a viewer that can't catch up (a TCP backlog that never drains) plays live instead, where
+        // its send queue skips pictures, rather than piling up references to the whole stream
+        RtpPrimingQueue &priming = session->getPriming();
+        if (priming.active() && priming.pkts.size() - priming.head + count > RTP_GOP_CACHE_MAX_PACKETS)
+        {
+            printf("viewer does not catch up with the cached GOP, playing live\n");
+            priming.clear();
+        }
+        if (priming.active())
+        {
+            for (size_t i = 0; i < count; ++i)
+                priming.pkts.push_back(rtpPacketRef(pkts[i]));
+            continue;
+        }
+
+        if (session->isTcpTransport())
+            sendPacketsTcp(session, pkts, count);
+        else
+            sendPacketsUdp(session, pkts, count);
+    }
+    submitRing();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        // with SO_TXTIME the packet waits in the kernel until it is due
+        uint64_t sent = (m_TxFlags & RTP_TX_UDP_TXTIME) && pkts[i]->due > now ? pkts[i]->due : now;
+        uint64_t delay = sent - pkts[i]->queued;
+        m_Stats.queueDelayNs += delay;
+        if (delay > m_Stats.maxQueueDelayNs)
+            m_Stats.maxQueueDelayNs = delay;
+    }
+    m_Stats.queued += count;
+}
+
+void CStreamer::setGopCache(uint64_t frameIntervalNs, int burstSpeed)
+{
+    m_GopFrameNs = frameIntervalNs;
+    m_GopSpeed = burstSpeed > 0 ? burstSpeed : 0;
+    if (!m_GopSpeed)
+        releaseGop();
+}
+
+void CStreamer::releaseGop()
+{
+    for (size_t i = 0; i < m_Gop.size(); ++i)
+        rtpPacketUnref(m_Gop[i]);
+    m_Gop.clear();
+}
+
+/**
+   Keep the packets being sent if they belong to the GOP of the last IRAP: the first access unit
+   of an IRAP picture, its parameter sets included, starts the cache over. A GOP of more than
+   RTP_GOP_CACHE_MAX_PACKETS is given up on, up to the next IRAP.
+ */
+void CStreamer::cacheGop(RtpPacket *const *pkts, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        RtpPacket *pkt = pkts[i];
+        if (m_AuStart && (pkt->flags & RTP_PACKET_IRAP))
+            releaseGop();
+        else if (m_Gop.empty() || m_Gop.size() >= RTP_GOP_CACHE_MAX_PACKETS)
+        {
+            releaseGop(); // no IRAP to start from
+            m_AuStart = pkt->mark != 0;
+            continue;
+        }
+        m_Gop.push_back(rtpPacketRef(pkt));
+        m_AuStart = pkt->mark != 0;
+    }
+}
+
+/**
+   A live viewer that starts now would wait for the next IRAP, up to a GOP. Instead it gets the
+   packets from the last IRAP on first, at m_GopSpeed times the frame rate (sendPrimingPackets()),
+   and the live packets queue up behind them until it caught up. Everything goes out in order, so
+   its sequence numbers and timestamps run on without a gap from the cached GOP into the live ones.
+ */
+void CStreamer::primeSession(CRtspSession *session)
+{
+    if (!m_GopSpeed || m_Gop.empty())
+        return;
+
+    RtpPrimingQueue &priming = session->getPriming();
+    priming.clear();
+    for (size_t i = 0; i < m_Gop.size(); ++i)
+        priming.pkts.push_back(rtpPacketRef(m_Gop[i]));
+    priming.due = monotonicNs();
+    if (!m_PrimingDue || priming.due < m_PrimingDue)
+        m_PrimingDue = priming.due;
+}
+
+/**
+   A live session starting on the cached GOP gets its first packet first, any other one the next
+   packet built. In the session's numbering: with its sequence number and timestamp offsets.
+ */
+void CStreamer::getPlayPosition(CRtspSession *session, uint16_t *seq, uint32_t *rtptime)
+{
+    uint32_t timestamp;
+    if (m_GopSpeed && !m_Gop.empty() && !session->m_streaming)
+    {
+        *seq = m_Gop[0]->seq;
+        timestamp = m_Gop[0]->timestamp;
+    }
+    else
+        nextRtpPosition(seq, &timestamp);
+    *seq = (uint16_t)(*seq + session->getSeqOffset());
+    *rtptime = timestamp + session->getTimestampOffset();
+}
+
+/**
+   Replay the due access units to the sessions being primed, one every frame interval / m_GopSpeed.
+   A TCP viewer gets the next one only once its backlog is below half of RTP_TCP_DROP_BYTES, so the
+   burst does not make its send queue skip pictures. A session whose queue ran empty plays live.
+ */
+uint64_t CStreamer::sendPrimingPackets()
+{
+    uint64_t now = monotonicNs();
+    uint64_t step = m_GopSpeed ? m_GopFrameNs / m_GopSpeed : 0;
+    m_PrimingDue = 0;
+
+    for (LinkedListElement *element = m_Clients.m_Next; element != &m_Clients; element = element->m_Next)
+    {
+        CRtspSession *session = static_cast<CRtspSession *>(element);
+        RtpPrimingQueue &priming = session->getPriming();
+        if (!priming.active())
+            continue;
+        if (!session->m_streaming || session->m_stopped)
+        {
+            priming.clear();
+            continue;
+        }
+
+        while (priming.active() && priming.due <= now)
+        {
+            if (session->isTcpTransport() && session->getTcpQueue().getBacklog(session->getClient()) >= RTP_TCP_DROP_BYTES / 2)
+            {
+                priming.due = now + step;
+                break;
+            }
+
+            size_t end = priming.head;
+            while (end < priming.pkts.size() && !priming.pkts[end++]->mark)
+                ;
+            RtpPacket *const *pkts = &priming.pkts[priming.head];
+            if (session->isTcpTransport())
+                sendPacketsTcp(session, pkts, end - priming.head);
+            else
+                sendPacketsUdp(session, pkts, end - priming.head);
+            for (; priming.head < end; ++priming.head)
+                rtpPacketUnref(priming.pkts[priming.head]);
+            priming.due += step;
+        }
+
+        if (!priming.active())
+        {
+            priming.clear(); // caught up with the live edge
+            continue;
+        }
+        priming.compact();
+        if (!m_PrimingDue || priming.due < m_PrimingDue)
+            m_PrimingDue = priming.due;
+    }
+    submitRing();
+    return m_PrimingDue;
+}
+
+// RTP over RTSP - we send the buffer + 4 byte additional header.
+// The packets go through the session's queue, written without blocking; a backed up viewer skips whole pictures.
+void CStreamer::sendPacketsTcp(CRtspSession *session, RtpPacket *const *pkts, size_t count)
+{
+    CTcpSendQueue &queue = session->getTcpQueue();
+    uint8_t hdr[RTP_TCP_HEADER_SIZE + RTP_HEADER_SIZE];
+    if (m_Ring)
+        queue.useRing(m_Ring); // no zerocopy through the ring
+    else if (m_TxFlags & RTP_TX_TCP_ZEROCOPY)
+        queue.useZeroCopy(session->getClient());
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        RtpPacket *pkt = pkts[i];
+        if (!queue.admit(session->getClient(), pkt))
+        {
+            ++m_Stats.dropped;
+            continue;
+        }
+
+        memcpy(hdr, rtpPacketTcpHeader(pkt), RTP_TCP_HEADER_SIZE);
+        rtpPatchHeader(&hdr[RTP_TCP_HEADER_SIZE], pkt, session);
+        queue.push(pkt, hdr);
+        session->onRtpSent(pkt);
+
+        ++m_Stats.packets;
+        m_Stats.bytes += pkt->len;
+    }
+    queue.flush(session->getClient(), &m_Stats.syscalls);
+}
+
+bool CStreamer::flushTcp(CRtspSession *session)
+{
+    bool ok = session->getTcpQueue().flush(session->getClient(), &m_Stats.syscalls);
+    submitRing();
+    return ok;
+}
+
+void CStreamer::setRing(CIoUring *ring)
+{
+    m_Ring = ring && ring->isValid() ? ring : NULL;
+}
+
+// hand the sends queued on the ring to the kernel, one io_uring_enter for all sessions
+void CStreamer::submitRing()
+{
+    if (!m_Ring)
+        return;
+    uint64_t enters = m_Ring->getEnters();
+    m_Ring->submit();
+    m_Stats.syscalls += m_Ring->getEnters() - enters;
+}
+
+// UDP - the packets go out with sendmmsg, RTP_SENDMMSG_BATCH packets per call.
+// With RTP_TX_UDP_GSO runs of equal sized packets (FU fragments) go out as one GSO send instead.
+// With an io_uring (setRing) they are queued on it, to go out with the other sessions' at the end of transmit().
+void CStreamer::sendPacketsUdp(CRtspSession *session, RtpPacket *const *pkts, size_t count)
+{
+    // the session's connected socket needs no address, the shared one the address resolved at SETUP
+    UDPSOCKET sock = session->getRtpSocket();
+    const sockaddr_in *addr = sock ? NULL : session->getRtpDest();
+    if (!sock)
+        sock = m_RtpSocket;
+
+    uint8_t hdrs[RTP_SENDMMSG_BATCH][RTP_HEADER_SIZE];
+    iovec iovs[RTP_SENDMMSG_BATCH][1 + RTP_PACKET_MAX_CHUNKS];
+    mmsghdr msgs[RTP_SENDMMSG_BATCH];
+    char txtimes[RTP_SENDMMSG_BATCH][UDP_TXTIME_CONTROL_SIZE];
+
+    // a GSO super datagram would leave in one piece, which defeats kernel pacing
+    bool txtime = (m_TxFlags & RTP_TX_UDP_TXTIME) != 0;
+    bool gso = (m_TxFlags & RTP_TX_UDP_GSO) && !txtime;
+
+    if (m_Ring && m_Ring->isValid())
+    {
+        // one linked chain per access unit, submitted with the other sessions' in transmit().
+        // Queued packets count as sent, the server moves the ones that complete with an error to failed
+        if (!m_Ring->reserve((unsigned)count))
+        {
+            m_Stats.failed += count; // in the stats line, no printf per frame
+            return;
+        }
+        uint8_t hdr[RTP_HEADER_SIZE];
+        for (size_t i = 0; i < count; ++i)
+        {
+            RtpPacket *pkt = pkts[i];
+            rtpPatchHeader(hdr, pkt, session);
+            if (!m_Ring->sendUdp(sock, addr, pkt, hdr, txtime ? pkt->due : 0, i + 1 < count))
+            {
+                m_Stats.failed += count - i;
+                break;
+            }
+            session->onRtpSent(pkt);
+            ++m_Stats.packets;
+            m_Stats.bytes += pkt->len;
+        }
+        return;
+    }
+
+    size_t next = 0;
+    while (next < count)
+    {
+        if (gso)
+        {
+            size_t run = gsoRunLength(pkts + next, count - next);
+            if (run > 1 && sendPacketsGso(session, sock, addr, pkts + next, run))
+            {
+                next += run;
+                continue;
+            }
+        }
+
+        unsigned n = 0;
+        for (; n < RTP_SENDMMSG_BATCH && next + n < count; ++n)
+        {
+            if (n && gso && gsoRunLength(pkts + next + n, count - next - n) > 1)
+                break; // leave the run to GSO
+
+            RtpPacket *pkt = pkts[next + n];
+            rtpPatchHeader(hdrs[n], pkt, session);
+            iovs[n][0].iov_base = hdrs[n];
+            iovs[n][0].iov_len = RTP_HEADER_SIZE;
+            memcpy(&iovs[n][1], pkt->chunk, pkt->chunks * sizeof(iovec));
+
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            msgs[n].msg_hdr.msg_name = (void *)addr;
+            msgs[n].msg_hdr.msg_namelen = addr ? sizeof(*addr) : 0;
+            msgs[n].msg_hdr.msg_iov = iovs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1 + pkt->chunks;
+            if (txtime)
+                udpmsgsettxtime(&msgs[n].msg_hdr, txtimes[n], pkt->due);
+        }
+
+        // sendmmsg stops at the first datagram it can't send, the ones behind it get their own try
+        unsigned done = 0;
+        while (done < n)
+        {
+            int sent = udpsocketsendmmsg(sock, msgs + done, n - done, &m_Stats.syscalls);
+            if (sent < 0 && txtime && (errno == EINVAL || errno == EPROTO || errno == ENOPROTOOPT))
+            {
+                // resend without departure times, pacing continues in userspace from the next access unit
+                printf("SO_TXTIME refused (errno=%d), falling back to userspace pacing\n", errno);
+                m_TxFlags &= ~RTP_TX_UDP_TXTIME;
+                txtime = false;
+                for (unsigned i = done; i < n; ++i)
+                {
+                    msgs[i].msg_hdr.msg_control = NULL;
+                    msgs[i].msg_hdr.msg_controllen = 0;
+                }
+                continue;
+            }
+            if (sent < 0)
+            {
+                printf("sendmmsg failed errno=%d\n", errno);
+                // out of buffers the rest fails as well, other errors are about this datagram
+                unsigned lost = (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) ? n - done : 1;
+                m_Stats.failed += lost;
+                done += lost;
+                continue;
+            }
+            for (int i = 0; i < sent; ++i)
+            {
+                session->onRtpSent(pkts[next + done + i]);
+                m_Stats.bytes += pkts[next + done + i]->len;
+            }
+            m_Stats.packets += sent;
+            done += sent;
+        }
+        next += n;
+    }
+}
+
+/**
+   Number of the count packets that can be sent as one GSO super datagram:
+   all of the same size, except for the last one which may be shorter.
+ */
+size_t CStreamer::gsoRunLength(RtpPacket *const *pkts, size_t count)
+{
+    int segment = pkts[0]->len;
+    size_t total = segment;
+    size_t run = 1;
+    while (run < count && run < RTP_GSO_MAX_SEGMENTS)
+    {
+        int len = pkts[run]->len;
+        if (len > segment || total + len > RTP_GSO_MAX_BYTES)
+            break;
+        ++run;
+        total += len;
+        if (len < segment)
+            break; // a shorter segment ends the run
+    }
+    return run;
+}
+
+/**
+   Send count packets back to back (each with its own RTP header) and let the kernel
+   split them with UDP_SEGMENT. The payloads are gathered in place, nothing is copied.
+   Returns false, and disables GSO for this streamer, if the kernel refuses; the caller
+   then sends the packets one by one.
+ */
+bool CStreamer::sendPacketsGso(CRtspSession *session, UDPSOCKET sock, const sockaddr_in *addr, RtpPacket *const *pkts, size_t count)
+{
+    uint8_t hdrs[RTP_GSO_MAX_SEGMENTS][RTP_HEADER_SIZE];
+    iovec iov[RTP_GSO_MAX_SEGMENTS * (1 + RTP_PACKET_MAX_CHUNKS)];
+    int iovcnt = 0;
+    size_t len = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        RtpPacket *pkt = pkts[i];
+        rtpPatchHeader(hdrs[i], pkt, session);
+        iov[iovcnt].iov_base = hdrs[i];
+        iov[iovcnt].iov_len = RTP_HEADER_SIZE;
+        memcpy(&iov[iovcnt + 1], pkt->chunk, pkt->chunks * sizeof(iovec));
+        iovcnt += 1 + pkt->chunks;
+        len += pkt->len;
+    }
+
+    ++m_Stats.syscalls;
+    ssize_t res = udpsocketsendgso(sock, iov, iovcnt, pkts[0]->len, addr);
+    if (res < 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP))
+    {
+        printf("UDP GSO not available (errno=%d), falling back to sendmmsg\n", errno);
+        m_TxFlags &= ~RTP_TX_UDP_GSO;
+        return false;
+    }
+    if (res < 0)
+    {
+        printf("GSO send failed errno=%d\n", errno);
+        m_Stats.failed += count; // one super datagram, it goes or it doesn't
+        return true;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        session->onRtpSent(pkts[i]);
+    m_Stats.packets += count;
+    m_Stats.bytes += len;
+    return true;
+}
+
+void CStreamer::watchRtcp(CEventLoop *loop)
+{
+    if (!m_udpRefCount || (m_RtcpLoop == loop && m_RtcpWatched == m_RtcpSocket))
+        return;
+    if (m_RtcpLoop)
+        m_RtcpLoop->remove(m_RtcpWatched, &m_RtcpHandler);
+    m_RtcpLoop = loop->add(m_RtcpSocket, EPOLLIN, &m_RtcpHandler) ? loop : NULL;
+    m_RtcpWatched = m_RtcpSocket;
+}
+
+void CStreamer::RtcpHandler::onEvent(uint32_t events)
+{
+    streamer->receiveRtcp();
+}
+
+/**
+   Read what waits on our RTCP socket, RTCP_RECV_BATCH datagrams per recvmmsg. The viewers all
+   report to the one socket, each on its own SSRC, so the source address does not matter.
+ */
+void CStreamer::receiveRtcp()
+{
+    static __thread uint8_t bufs[RTCP_RECV_BATCH][RTCP_PACKET_MAX];
+    iovec iovs[RTCP_RECV_BATCH];
+    mmsghdr msgs[RTCP_RECV_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RTCP_RECV_BATCH; ++i)
+    {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = RTCP_PACKET_MAX;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n;
+    do
+    {
+        n = udpsocketrecvmmsg(m_RtcpSocket, msgs, RTCP_RECV_BATCH);
+        for (int i = 0; i < n; ++i)
+            handleRtcp(bufs[i], msgs[i].msg_len);
+    } while (n == RTCP_RECV_BATCH);
+}
+
+void CStreamer::handleRtcp(const uint8_t *buf, size_t len)
+{
+    RtcpReportBlock blocks[RTCP_MAX_BLOCKS];
+    size_t count = rtcpParseReports(buf, len, blocks, RTCP_MAX_BLOCKS);
+    if (!count)
+        return;
+
+    uint64_t arrival = rtcpNtpNow();
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (LinkedListElement *element = m_Clients.m_Next; element != &m_Clients; element = element->m_Next)
+        {
+            CRtspSession *session = static_cast<CRtspSession *>(element);
+            if (session->getSsrc() == blocks[i].ssrc)
+            {
+                session->onReceiverReport(blocks[i], arrival);
+                break;
+            }
+        }
+    }
+}
+
+/**
+   Every playing session gets a sender report on the first call after its PLAY, then at random
+   intervals of 0.5 to 1.5 times RTCP_INTERVAL_MS (RFC 3550 6.3.1), so the reports of viewers
+   that started together spread out.
+ */
+void CStreamer::sendSenderReports()
+{
+    if (!m_ClockNs)
+        return; // no media clock yet
+
+    uint64_t now = monotonicNs();
+    for (LinkedListElement *element = m_Clients.m_Next; element != &m_Clients; element = element->m_Next)
+    {
+        CRtspSession *session = static_cast<CRtspSession *>(element);
+        if (!session->m_streaming || session->m_stopped || session->getRtcpDue() > now)
+            continue;
+        if (!session->getRtpPacketsSent())
+            continue; // not a sender to this viewer yet (RFC 3550 6.4), reports start with its first packet
+
+        sendSenderReport(session, now);
+        uint64_t interval = RTCP_INTERVAL_MS * 1000000ULL;
+        session->setRtcpDue(now + interval / 2 + interval * (getRandom() % 1001) / 1000);
+    }
+}
+
+/**
+   The SR maps now to the session's RTP timeline: the stream timestamp due now by the media clock,
+   plus the session's offset. Over TCP it goes on interleaved channel 1, behind the queued packets.
+ */
+void CStreamer::sendSenderReport(CRtspSession *session, uint64_t nowNs)
+{
+    uint8_t buf[RTP_TCP_HEADER_SIZE + RTCP_PACKET_MAX];
+    int64_t sinceClock = (int64_t)(nowNs - m_ClockNs);
+    uint32_t timestamp = m_ClockTimestamp + (uint32_t)(sinceClock * 90000 / 1000000000LL) + session->getTimestampOffset();
+    size_t len = rtcpBuildSenderReport(buf + RTP_TCP_HEADER_SIZE, RTCP_PACKET_MAX, session->getSsrc(), rtcpNtpNow(), timestamp,
+                                       session->getRtpPacketsSent(), session->getRtpOctetsSent(), m_Cname.c_str());
+    if (!len)
+        return;
+
+    if (session->isTcpTransport())
+    {
+        buf[0] = '$';
+        buf[1] = RTSP_RTCP_CHANNEL;
+        buf[2] = (uint8_t)(len >> 8);
+        buf[3] = (uint8_t)len;
+        session->getTcpQueue().pushBytes((const char *)buf, RTP_TCP_HEADER_SIZE + len);
+        flushTcp(session);
+        return;
+    }
+
+    if (!m_RtcpSocket || !session->getRtcpClientPort())
+        return;
+    ++m_Stats.syscalls;
+    if (udpsocketsend(m_RtcpSocket, buf + RTP_TCP_HEADER_SIZE, len, session->getRtpDest()->sin_addr.s_addr, session->getRtcpClientPort()) < 0)
+        printf("RTCP send failed errno=%d\n", errno);
+}
+
+String CStreamer::buildSdp()
+{
+    char origin[64];
+    snprintf(origin, sizeof(origin), "o=- 0 %u IN IP4 {server_addr}\r\n", m_SdpVersion);
+    return String("v=0\r\n") + origin +
+           "s=Video Streaming\r\n"
+           "i=H.265\r\n"
+           "c=IN IP4 0.0.0.0\r\n"
+           "t=0 0\r\n"
+           "m=video 0 RTP/AVP 96\r\n"
+           "a=rtpmap:96 H265/90000\r\n" +
+           sdpMediaAttributes();
+}
+
+const CRtspResponses &CStreamer::getResponses()
+{
+    if (!m_Responses)
+        m_Responses = m_OwnResponses = new CRtspResponses(buildSdp());
+    return *m_Responses;
+}
+
+/**
+   A session asking after this gets a description rendered anew. Responses shared with other
+   streamers are left to them, as those may still run on the old parameters.
+ */
+void CStreamer::invalidateResponses()
+{
+    delete m_OwnResponses;
+    m_OwnResponses = NULL;
+    m_Responses = NULL;
+    ++m_SdpVersion;
+}
+
+u_short CStreamer::GetRtpServerPort()
+{
+    return m_RtpServerPort;
+};
+
+u_short CStreamer::GetRtcpServerPort()
+{
+    return m_RtcpServerPort;
+};
+
+bool CStreamer::InitUdpTransport(void)
+{
+    if (m_udpRefCount != 0)
+    {
+        ++m_udpRefCount;
+        return true;
+    }
+
+    for (u_short P = 6970; P < 0xFFFE; P += 2)
+    {
+        m_RtpSocket = udpsocketcreate(P);
+        if (m_RtpSocket)
+        { // Rtp socket was bound successfully. Lets try to bind the consecutive Rtsp socket
+            m_RtcpSocket = udpsocketcreate(P + 1);
+            if (m_RtcpSocket)
+            {
+                m_RtpServerPort = P;
+                m_RtcpServerPort = P + 1;
+                break;
+            }
+            else
+            {
+                udpsocketclose(m_RtpSocket);
+                udpsocketclose(m_RtcpSocket);
+            };
+        }
+    };
+
+    // sessions bind connected sockets of their own to our RTP port
+    if ((m_TxFlags & RTP_TX_UDP_CONNECTED) && !udpsocketshareport(m_RtpSocket))
+    {
+        printf("can't share the RTP port errno=%d, sending from one socket\n", errno);
+        m_TxFlags &= ~RTP_TX_UDP_CONNECTED;
+    }
+    if ((m_TxFlags & RTP_TX_UDP_TXTIME) && !udpsocketenabletxtime(m_RtpSocket))
+    {
+        printf("SO_TXTIME not available (errno=%d), falling back to userspace pacing\n", errno);
+        m_TxFlags &= ~RTP_TX_UDP_TXTIME;
+    }
+    ++m_udpRefCount;
+    return true;
+}
+
+void CStreamer::ReleaseUdpTransport(void)
+{
+    --m_udpRefCount;
+    if (m_udpRefCount == 0)
+    {
+        m_RtpServerPort = 0;
+        m_RtcpServerPort = 0;
+        if (m_RtcpLoop)
+            m_RtcpLoop->remove(m_RtcpWatched, &m_RtcpHandler);
+        m_RtcpLoop = NULL;
+        udpsocketclose(m_RtpSocket);
+        udpsocketclose(m_RtcpSocket);
+
+        m_RtpSocket = NULLSOCKET;
+        m_RtcpSocket = NULLSOCKET;
+    }
+}
+
+/**
+   Call handleRequests on all sessions
+ */
+bool CStreamer::handleRequests(uint32_t readTimeoutMs)
+{
+    bool retVal = true;
+    LinkedListElement *element = m_Clients.m_Next;
+    while (element != &m_Clients)
+    {
+        CRtspSession *session = static_cast<CRtspSession *>(element);
+        retVal &= session->handleRequests(readTimeoutMs);
+        if (!session->getTcpQueue().empty() && !flushTcp(session)) // no EPOLLOUT here, retry on every call
+            session->m_stopped = true;
+
+        element = element->m_Next;
+
+        if (session->m_stopped)
+        {
+            // remove session here, so we wont have to send to it
+            delete session;
+        }
+    }
+
+    return retVal;
+}
+
+#include <assert.h>
+/**
+ * General Rulle :
+ * Remove "00 00 00 01" from the original code NAL stream, add a tcp (12 Byte + 2Bytes(length)) or udp (12bits) header to the header, and then send it out.
+ */
+
+void CStreamer::rtpSendNALH265(RTPMuxContext *ctx, const uint8_t *nal, int size, int last)
+{
+    // nobody to send to, and no GOP to keep for the next viewer
+    if (!m_GopSpeed && !anyStreamingSessions())
+    {
+        if (m_Aggregate)
+            rtpPacketUnref(m_Aggregate);
+        m_Aggregate = NULL;
+        return;
+    }
+
+    // Single NAL Packet or Aggregation Packets
+    if (size <= RTP_PAYLOAD_MAX)
+    {
+
+        // Handle Aggregation Packets
+        // Multiple small NAL units are encapsulated into a single RTP packet to reduce RTP overhead
+        // Adding 4 bytes for Payload Header (2 bytes) + NAL Unit size (2 bytes)
+        if (ctx->aggregation && size + 4 <= RTP_PAYLOAD_MAX)
+        {
+
+            /*                       1                   2                   3
+             *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  |   PayloadHdr (Type=48)        |   NALU 1 Size                 |
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  |           NALU 1 HDR          |   NALU 1 Data                 |
+             *  |           ...                         ....                    |
+             *                  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  |   ...         |      NALU 2 Size              | NALU 2 HDR    |
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  |    NALU 2 HDR |   NALU 2 Data         ...                     |
+             *  |           ...                         ...                     |
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             * */
+
+            // If remaining buffer space (or room for chunks) is insufficient, send existing data
+            if (m_Aggregate && (rtpPacketPayloadLen(m_Aggregate) + 2 + size > RTP_PAYLOAD_MAX ||
+                                m_Aggregate->chunks + 2 > RTP_PACKET_MAX_CHUNKS))
+            {
+                rtpSendData(ctx, m_Aggregate);
+                m_Aggregate = NULL;
+            }
+            /*   PayloadHdr (Type=48)
+             *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 5
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  |F|    Type   | LayerId   | TID |
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *      F       = 0
+             *      Type    = 48 (Aggregation Uint AU)
+             *      LayerId = 0
+             *      TID     = 1
+             */
+            // First entry in the aggregation packet
+            if (!m_Aggregate)
+            {
+                m_Aggregate = rtpNewPacket();
+                if (!m_Aggregate)
+                    return;
+                const uint8_t payloadHdr[2] = {(48 << 1), 1};
+                rtpPacketAddBytes(m_Aggregate, payloadHdr, 2);
+            }
+
+            // Add NALU Size, NALU Header, and NALU Data
+            uint8_t nalSize[2];
+            Load16(nalSize, static_cast<uint16_t>(size)); // Load NAL size
+            rtpPacketAddBytes(m_Aggregate, nalSize, 2);
+            rtpPacketAddRef(m_Aggregate, nal, size); // NALU Header & Data in place
+
+            // If this is the last NAL of the access unit, send the buffer
+            if (last == 1)
+            {
+                rtpSendData(ctx, m_Aggregate, 1);
+                m_Aggregate = NULL;
+            }
+        }
+        // Single NAL Unit RTP Packet
+        else
+        {
+            // the bits are directly used as loads
+            /*
+             *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 5 7 0 1 2 3 4 5 6 . . .
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  |F|    Type   | LayerId   | TID | NAL unit payload data  ... |
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             * */
+            // the NAL units aggregated so far come first
+            if (m_Aggregate)
+            {
+                rtpSendData(ctx, m_Aggregate);
+                m_Aggregate = NULL;
+            }
+            RtpPacket *pkt = rtpNewPacket();
+            if (!pkt)
+                return;
+            rtpPacketAddRef(pkt, nal, size);
+            rtpSendData(ctx, pkt, last);
+        }
+    }
+    else // Fragmentation Unit
+    {
+        // If buffer has existing data, send it
+        if (m_Aggregate)
+        {
+            rtpSendData(ctx, m_Aggregate);
+            m_Aggregate = NULL;
+        }
+
+        uint8_t nalu_type = (nal[0] >> 1) & 0x3F;
+
+        /*                       1                   2                   3
+         *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         *  |   PayloadHdr (Type=49)        |    FU header  |               |
+         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         *  |   ...         |         FU payload                            |
+         *  |   ...                                 ...                     |
+         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         */
+
+        /*
+         *   PayloadHdr (Type=49)
+         *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 5
+         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         *  |F|    Type   | LayerId   | TID |
+         *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         *      F       = 0
+         *      Type    = 49 (fragmention uint FU)
+         *      LayerId = 0
+         *      TID     = 1
+         */
+        uint8_t fuHdr[3];
+        fuHdr[0] = (49 << 1);
+        fuHdr[1] = 1;
+
+        /* Create the FU header
+         *
+         *   0 1 2 3 4 5 6 7
+         *  +-+-+-+-+-+-+-+-+
+         *  |S|E|   FuType  |
+         *  +-+-+-+-+-+-+-+-+
+         * S start : Variable
+         * E End   : Variable
+         * FuType  :  nalu_type
+         */
+        // S = 1 (start fragment), E = 0 (not end), FuType = nalu_type
+        fuHdr[2] = nalu_type;
+        fuHdr[2] |= 1 << 7; // Set S=1 , E=0
+        nal += 2;           // Skip the original NAL header
+        size -= 2;
+        const uint8_t header_Size = 3; // sizeof(PayloadHdr) + sizeof(FU header)
+
+        // Fragment the NAL unit and send in multiple RTP packets if necessary,
+        // the fragments reference the NAL unit in place
+        while (size + header_Size > RTP_PAYLOAD_MAX)
+        {
+            RtpPacket *pkt = rtpNewPacket();
+            if (!pkt)
+                return;
+            rtpPacketAddBytes(pkt, fuHdr, header_Size);
+            rtpPacketAddRef(pkt, nal, RTP_PAYLOAD_MAX - header_Size);
+            rtpSendData(ctx, pkt);
+            nal += RTP_PAYLOAD_MAX - header_Size;
+            size -= RTP_PAYLOAD_MAX - header_Size;
+            fuHdr[2] &= 0x7f; // Clear S and E bits
+        }
+        // Final fragment, set E bit to 1
+        fuHdr[2] |= 0x40;
+        RtpPacket *pkt = rtpNewPacket();
+        if (!pkt)
+            return;
+        rtpPacketAddBytes(pkt, fuHdr, header_Size);
+        rtpPacketAddRef(pkt, nal, size);
+        rtpSendData(ctx, pkt, last);
+    }
+}
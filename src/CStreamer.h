@@ -1,73 +1,229 @@
-#pragma once
-
-#include "platglue.h"
-#include "LinkedListElement.h"
-#include "RTPEnc.h"
-typedef unsigned const char *BufPtr;
-
-class CRtspSession;
-
-class CStreamer
-{
-public:
-    CStreamer(u_short width, u_short height);
-    virtual ~CStreamer();
-
-    CRtspSession *addSession(SOCKET aClient);
-    LinkedListElement *getClientsListHead() { return &m_Clients; }
-
-    int anySessions() { return m_Clients.NotEmpty(); }
-
-    bool handleRequests(uint32_t readTimeoutMs);
-
-    u_short GetRtpServerPort();
-    u_short GetRtcpServerPort();
-
-    virtual void streamImage(uint32_t curMsec) = 0; // send a new image to the client
-    bool InitUdpTransport(void);
-    void ReleaseUdpTransport(void);
-    bool debug;
-    void setURI(String hostport, String pres = "live", String stream = "1"); // set URI parts for sessions to use.
-    String getURIHost() { return m_URIHost; };                               // for getting things back by sessions
-    String getURIPresentation() { return m_URIPresentation; };
-    String getURIStream() { return m_URIStream; };
-
-protected:
-    void rtpSendNALH265(RTPMuxContext *ctx, const uint8_t *nal, int size, int last);
-    String m_URIHost;         // Host:port URI part that client should use to connect. also it is reported in session answers where appropriate.
-    String m_URIPresentation; // name of presentation part of URI. sessions will check if client used correct one
-    String m_URIStream;       // stream part of the URI.
-
-private:
-    int rtpSendData(RTPMuxContext *ctx, const uint8_t *buf, int len, int mark = 0);
-
-    UDPSOCKET m_RtpSocket;  // RTP socket for streaming RTP packets to client
-    UDPSOCKET m_RtcpSocket; // RTCP socket for sending/receiving RTCP packages
-
-    IPPORT m_RtpServerPort;  // RTP sender port on server
-    IPPORT m_RtcpServerPort; // RTCP sender port on server
-
-    u_short m_SequenceNumber;
-    uint32_t m_Timestamp;
-    int m_SendIdx;
-
-    LinkedListElement m_Clients;
-    uint32_t m_prevMsec;
-
-    int m_udpRefCount;
-
-    u_short m_width; // image data info
-    u_short m_height;
-};
-
-// When JPEG is stored as a file it is wrapped in a container
-// This function fixes up the provided start ptr to point to the
-// actual JPEG stream data and returns the number of bytes skipped
-// returns true if the file seems to be valid jpeg
-// If quant tables can be found they will be stored in qtable0/1
-bool decodeJPEGfile(BufPtr *start, uint32_t *len, BufPtr *qtable0, BufPtr *qtable1);
-bool findJPEGheader(BufPtr *start, uint32_t *len, uint8_t marker);
-
-// Given a jpeg ptr pointing to a pair of length bytes, advance the pointer to
-// the next 0xff marker byte
-void nextJpegBlock(BufPtr *start);
+#pragma once
+
+#include "platglue.h"
+#include "LinkedListElement.h"
+#include "RTPEnc.h"
+#include "RtpPacket.h"
+#include "CPacer.h"
+#include "CIoUring.h"
+#include "CRtspResponses.h"
+#include "Rtcp.h"
+#include <vector>
+typedef unsigned const char *BufPtr;
+
+class CRtspSession;
+
+#define RTP_SENDMMSG_BATCH 64 // UDP packets handed to the kernel per sendmmsg call
+#define RTP_GSO_MAX_SEGMENTS 64 // UDP_SEGMENT limit of the kernel
+#define RTP_GSO_MAX_BYTES 65000 // one GSO send must still fit one (unsegmented) IPv4 UDP datagram
+
+// transmit options, see CStreamer::setTxFlags
+#define RTP_TX_UDP_GSO 0x01 // runs of equal sized UDP packets go out in one sendmsg with UDP_SEGMENT
+#define RTP_TX_UDP_TXTIME 0x02 // paced UDP packets are handed to the kernel at once with SO_TXTIME departure times
+#define RTP_TX_UDP_CONNECTED 0x04 // every UDP session sends from a socket of its own, connect()ed to the client
+#define RTP_TX_TCP_ZEROCOPY 0x08 // large RTP over RTSP sends go out with MSG_ZEROCOPY (see CTcpSendQueue)
+#define RTP_TX_IO_URING 0x10 // all sends of a frame go through the server's io_uring, one io_uring_enter (see CIoUring)
+
+#define RTP_GOP_CACHE_MAX_PACKETS 16384 // a longer GOP is not cached, joining viewers wait for the next IRAP
+
+// transmit counters of a streamer, summed over all its sessions
+struct RtpSendStats
+{
+    uint64_t frames;   // sendPackets() calls that had packets
+    uint64_t packets;  // RTP packets sent
+    uint64_t bytes;    // RTP bytes sent (without RTP over RTSP framing)
+    uint64_t syscalls; // send calls it took
+    uint64_t queued;          // packets that went through the send queue (all of them, paced or not)
+    uint64_t queueDelayNs;    // their summed time from being built to being sent
+    uint64_t maxQueueDelayNs; // the longest of those
+    uint64_t dropped;         // packets TCP viewers skipped, whole pictures (see CTcpSendQueue)
+    uint64_t failed;          // UDP packets the kernel refused or the ring had no room for, not in packets and bytes
+};
+
+/**
+   What a viewer joining a live stream gets before the live packets: the cached GOP and the packets
+   sent live while it is being replayed, in order (references held).
+ */
+struct RtpPrimingQueue
+{
+    std::vector<RtpPacket *> pkts;
+    size_t head;  // next packet to send
+    uint64_t due; // CLOCK_MONOTONIC ns the next access unit goes out
+
+    RtpPrimingQueue() : head(0), due(0) {}
+    ~RtpPrimingQueue() { clear(); }
+    bool active() const { return head < pkts.size(); }
+    void clear()
+    {
+        for (size_t i = head; i < pkts.size(); ++i)
+            rtpPacketUnref(pkts[i]);
+        pkts.clear();
+        head = 0;
+    }
+    void compact() // forget the sent packets once they are the larger part
+    {
+        if (head < pkts.size() / 2)
+            return;
+        pkts.erase(pkts.begin(), pkts.begin() + head);
+        head = 0;
+    }
+};
+
+class CStreamer
+{
+public:
+    CStreamer(u_short width, u_short height);
+    virtual ~CStreamer();
+
+    CRtspSession *addSession(SOCKET aClient);
+    LinkedListElement *getClientsListHead() { return &m_Clients; }
+
+    int anySessions() { return m_Clients.NotEmpty(); }
+
+    bool handleRequests(uint32_t readTimeoutMs);
+
+    u_short GetRtpServerPort();
+    u_short GetRtcpServerPort();
+
+    virtual void streamImage(uint32_t curMsec) = 0; // send a new image to the client
+    bool InitUdpTransport(void);
+    void ReleaseUdpTransport(void);
+    bool debug;
+    void setURI(String hostport, String pres = "live", String stream = "1"); // set URI parts for sessions to use.
+    String getURIHost() { return m_URIHost; };                               // for getting things back by sessions
+    String getURIPresentation() { return m_URIPresentation; };
+    String getURIStream() { return m_URIStream; };
+    const RtpSendStats &getStats() { return m_Stats; }
+    void setTxFlags(int flags) { m_TxFlags = flags; }
+    int getTxFlags() { return m_TxFlags; }
+
+    /// spread each access unit over spreadPercent of the frame interval, at targetKbps or faster,
+    /// smoothing the rate over smoothFrames frames (see CPacer)
+    void setPacing(uint64_t frameIntervalNs, int spreadPercent, int targetKbps, int smoothFrames = 0);
+    bool isPaced() { return m_Pacer.enabled(); }
+    int getSmoothFrames() { return m_Pacer.smoothFrames(); }
+    /// send the paced packets that are due, returns when the next one is (CLOCK_MONOTONIC ns, 0 = queue empty)
+    uint64_t sendPacedPackets();
+    uint64_t nextPacedDue() { return m_PacedHead < m_Paced.size() ? m_Paced[m_PacedHead]->due : 0; }
+    void clearMaxQueueDelay() { m_Stats.maxQueueDelayNs = 0; } // per report
+    /// write what waits in the TCP queue of session, when its socket became writable
+    bool flushTcp(CRtspSession *session);
+    /// send through ring (shared with the server's other streamers) instead of sendmmsg/sendmsg, NULL = synchronous
+    void setRing(CIoUring *ring);
+
+    /// keep the packets since the last IRAP, so viewers joining later start on it at burstSpeed times real time
+    void setGopCache(uint64_t frameIntervalNs, int burstSpeed);
+    /// session starts playing mid-GOP: replay the cached GOP to it before it gets the live packets
+    void primeSession(CRtspSession *session);
+    /// send the cached access units that are due to the sessions being primed, returns when the next one is (0 = none)
+    uint64_t sendPrimingPackets();
+    uint64_t nextPrimingDue() { return m_PrimingDue; }
+    /// sequence number and RTP timestamp of the first packet session gets once it plays (RTP-Info of PLAY)
+    void getPlayPosition(CRtspSession *session, uint16_t *seq, uint32_t *rtptime);
+
+    /// read the receiver reports that arrive on our RTCP socket from loop on (again after the socket changed)
+    void watchRtcp(CEventLoop *loop);
+    /// take the report blocks of an RTCP compound packet from a viewer, over UDP or interleaved
+    void handleRtcp(const uint8_t *buf, size_t len);
+    /// send the sender reports that are due, about every RTCP_INTERVAL_MS per playing session
+    void sendSenderReports();
+
+    virtual String buildSdp(); // session description of our stream, for DESCRIBE
+    /// the RTSP responses of our stream, rendered on first use unless shared by setResponses()
+    const CRtspResponses &getResponses();
+    /// use responses of another streamer on the same stream (not owned)
+    void setResponses(const CRtspResponses *responses) { m_Responses = responses; }
+
+protected:
+    // packetize a NAL unit (without start code). The packets reference the NAL in place, so it must
+    // stay valid (and unchanged) as long as packets may be around - our sources are whole files in memory.
+    // last = 1 for the last NAL unit of an access unit: its last packet gets the RTP marker bit.
+    void rtpSendNALH265(RTPMuxContext *ctx, const uint8_t *nal, int size, int last);
+    // fan out the packets built since the last call to all playing sessions. With smoothing they are
+    // aheadFrames early and nextBytes[0..next) are the sizes of the access units that follow.
+    void sendPackets(int aheadFrames = 0, const uint64_t *nextBytes = NULL, size_t next = 0);
+    void setAccessUnitFlags(int flags); // RTP_PACKET_xxx of the packets built since the last sendPackets()
+    virtual String sdpMediaAttributes() { return ""; } // a= lines of the video media, after rtpmap
+    virtual void nextRtpPosition(uint16_t *seq, uint32_t *timestamp) { *seq = 0; *timestamp = 0; } // of the next packet built
+    /// the session description changed: render the responses again, on our own from now on
+    void invalidateResponses();
+    void setFrameSize(u_short width, u_short height) { m_width = width; m_height = height; }
+    String m_URIHost;         // Host:port URI part that client should use to connect. also it is reported in session answers where appropriate.
+    String m_URIPresentation; // name of presentation part of URI. sessions will check if client used correct one
+    String m_URIStream;       // stream part of the URI.
+
+private:
+    RtpPacket *rtpNewPacket();
+    int rtpSendData(RTPMuxContext *ctx, RtpPacket *pkt, int mark = 0);
+    bool anyStreamingSessions();
+    void transmit(RtpPacket *const *pkts, size_t count, uint64_t now);
+    void cacheGop(RtpPacket *const *pkts, size_t count);
+    void receiveRtcp();
+    void sendSenderReport(CRtspSession *session, uint64_t nowNs);
+    void releaseGop();
+    void sendPacketsTcp(CRtspSession *session, RtpPacket *const *pkts, size_t count);
+    void sendPacketsUdp(CRtspSession *session, RtpPacket *const *pkts, size_t count);
+    size_t gsoRunLength(RtpPacket *const *pkts, size_t count);
+    bool sendPacketsGso(CRtspSession *session, UDPSOCKET sock, const sockaddr_in *addr, RtpPacket *const *pkts, size_t count);
+    void submitRing();
+
+    UDPSOCKET m_RtpSocket;  // RTP socket for streaming RTP packets to client
+    UDPSOCKET m_RtcpSocket; // RTCP socket for sending/receiving RTCP packages
+
+    IPPORT m_RtpServerPort;  // RTP sender port on server
+    IPPORT m_RtcpServerPort; // RTCP sender port on server
+
+    u_short m_SequenceNumber;
+    uint32_t m_Timestamp;
+    int m_SendIdx;
+
+    LinkedListElement m_Clients;
+    std::vector<RtpPacket *> m_Packets; // packetized once, sent to every session
+    CPacer m_Pacer;
+    std::vector<RtpPacket *> m_Paced;   // waiting for their departure time, in order
+    size_t m_PacedHead;                 // first packet of m_Paced not sent yet
+    RtpSendStats m_Stats;
+    int m_TxFlags;
+    CIoUring *m_Ring;       // io_uring backend, NULL = sendmmsg/sendmsg
+    const CRtspResponses *m_Responses;
+    CRtspResponses *m_OwnResponses; // rendered by getResponses()
+    unsigned m_SdpVersion;  // of the origin line, counts invalidateResponses()
+    std::vector<RtpPacket *> m_Gop; // packets sent since the last IRAP started (references held)
+    int m_GopSpeed;         // replay speed of the cached GOP, 0 = no GOP cache
+    uint64_t m_GopFrameNs;  // frame interval of the replay
+    bool m_AuStart;         // the next packet sent starts an access unit
+    uint64_t m_PrimingDue;  // earliest RtpPrimingQueue::due of our sessions, 0 = none priming
+
+    // reads m_RtcpSocket when the loop reports it readable
+    struct RtcpHandler : public CEventHandler
+    {
+        CStreamer *streamer;
+        virtual void onEvent(uint32_t events);
+    };
+    RtcpHandler m_RtcpHandler;
+    CEventLoop *m_RtcpLoop;   // m_RtcpSocket is registered there, NULL = not watched
+    UDPSOCKET m_RtcpWatched;  // the socket that is
+    String m_Cname;           // SDES CNAME of our sender reports
+    uint32_t m_ClockTimestamp; // media clock: the stream timestamp that is due at m_ClockNs
+    uint64_t m_ClockNs;        // CLOCK_MONOTONIC, 0 = nothing sent yet
+    uint64_t m_FrameNs;        // frame interval, see setPacing
+    RtpPacket *m_Aggregate; // aggregation packet being filled, if any
+    uint32_t m_prevMsec;
+
+    int m_udpRefCount;
+
+    u_short m_width; // image data info
+    u_short m_height;
+};
+
+// When JPEG is stored as a file it is wrapped in a container
+// This function fixes up the provided start ptr to point to the
+// actual JPEG stream data and returns the number of bytes skipped
+// returns true if the file seems to be valid jpeg
+// If quant tables can be found they will be stored in qtable0/1
+bool decodeJPEGfile(BufPtr *start, uint32_t *len, BufPtr *qtable0, BufPtr *qtable1);
+bool findJPEGheader(BufPtr *start, uint32_t *len, uint8_t marker);
+
+// Given a jpeg ptr pointing to a pair of length bytes, advance the pointer to
+// the next 0xff marker byte
+void nextJpegBlock(BufPtr *start);
@@ -0,0 +1,313 @@
+#include "CTcpSendQueue.h"
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+CTcpSendQueue::CTcpSendQueue()
+{
+    m_First = NULL;
+    m_Head = NULL;
+    m_Last = NULL;
+    m_Spare = NULL;
+    m_HeadSent = 0;
+    m_Bytes = 0;
+    m_ResponseBytes = 0;
+    m_InFrame = false;
+    m_Dropping = false;
+    m_Resync = false;
+    m_DroppedFrames = 0;
+    m_ZeroCopy = false;
+    m_ZeroCopyTried = false;
+    m_ZeroCopyNext = 0;
+    m_ZeroCopyDone = 0;
+    m_Ring = NULL;
+    m_Failed = false;
+}
+
+CTcpSendQueue::~CTcpSendQueue()
+{
+    if (m_Flush.isPending())
+        m_Ring->wait(&m_Flush); // the kernel still reads our iovecs and entries
+    while (m_First)
+    {
+        Entry *e = m_First;
+        m_First = e->next;
+        rtpPacketUnref(e->pkt);
+        delete e;
+    }
+    while (m_Spare)
+    {
+        Entry *e = m_Spare;
+        m_Spare = e->next;
+        delete e;
+    }
+}
+
+bool CTcpSendQueue::admit(SOCKET sock, RtpPacket *pkt)
+{
+    if (!m_InFrame)
+    {
+        m_InFrame = true;
+
+        size_t backlog = m_Bytes + socketunacked(sock);
+        if (m_Resync && (pkt->flags & RTP_PACKET_IRAP) && backlog < RTP_TCP_DROP_BYTES)
+            m_Resync = false;
+        else if (!m_Resync && backlog >= RTP_TCP_QUEUE_MAX_BYTES)
+            m_Resync = true; // skipping a reference picture breaks the pictures after it, up to the next IRAP
+
+        m_Dropping = m_Resync || ((pkt->flags & RTP_PACKET_DROPPABLE) && backlog >= RTP_TCP_DROP_BYTES);
+        if (m_Dropping)
+            ++m_DroppedFrames;
+    }
+
+    bool keep = !m_Dropping;
+    if (pkt->mark)
+        m_InFrame = false;
+    return keep;
+}
+
+// a recycled entry at the end of the queue, so queueing does not allocate once the queue had its size
+CTcpSendQueue::Entry *CTcpSendQueue::append()
+{
+    Entry *e = m_Spare;
+    if (e)
+        m_Spare = e->next;
+    else
+        e = new Entry();
+    e->next = NULL;
+    e->zeroCopy = false;
+
+    if (m_Last)
+        m_Last->next = e;
+    else
+        m_First = e;
+    m_Last = e;
+    if (!m_Head)
+        m_Head = e;
+    return e;
+}
+
+void CTcpSendQueue::push(RtpPacket *pkt, const uint8_t *hdr)
+{
+    Entry *e = append();
+    e->pkt = rtpPacketRef(pkt);
+    memcpy(e->hdr, hdr, sizeof(e->hdr));
+    e->len = RTP_TCP_HEADER_SIZE + pkt->len;
+    m_Bytes += e->len;
+}
+
+void CTcpSendQueue::pushBytes(const char *data, size_t len)
+{
+    Entry *e = append();
+    e->pkt = NULL;
+    e->bytes.assign(data, len);
+    e->len = len;
+    m_Bytes += len;
+    m_ResponseBytes += len;
+}
+
+// gather the entries from the head on into iov, without what was written of the first one already
+int CTcpSendQueue::gather(iovec *iov, size_t *bytes)
+{
+    int iovcnt = 0;
+    *bytes = 0;
+    for (Entry *i = m_Head; i; i = i->next)
+    {
+        Entry &e = *i;
+        int need = e.pkt ? 1 + e.pkt->chunks : 1;
+        if (iovcnt + need > RTP_TCP_IOV_MAX)
+            break;
+
+        if (e.pkt)
+        {
+            iov[iovcnt].iov_base = e.hdr;
+            iov[iovcnt].iov_len = sizeof(e.hdr);
+            memcpy(&iov[iovcnt + 1], e.pkt->chunk, e.pkt->chunks * sizeof(iovec));
+        }
+        else
+        {
+            iov[iovcnt].iov_base = (void *)e.bytes.data();
+            iov[iovcnt].iov_len = e.bytes.size();
+        }
+
+        if (i == m_Head)
+        {
+            size_t skip = m_HeadSent;
+            for (int v = 0; v < need && skip; ++v)
+            {
+                size_t n = skip < iov[v].iov_len ? skip : iov[v].iov_len;
+                iov[v].iov_base = (uint8_t *)iov[v].iov_base + n;
+                iov[v].iov_len -= n;
+                skip -= n;
+            }
+        }
+        iovcnt += need;
+        *bytes += e.len - (i == m_Head ? m_HeadSent : 0);
+    }
+    return iovcnt;
+}
+
+// advance past what was written, entries a zerocopy send points into wait for its completion
+void CTcpSendQueue::advance(size_t written, bool zeroCopy)
+{
+    m_Bytes -= written;
+    while (written)
+    {
+        Entry &e = *m_Head;
+        if (zeroCopy)
+        {
+            e.zeroCopy = true;
+            e.zeroCopyId = m_ZeroCopyNext;
+        }
+        size_t left = e.len - m_HeadSent;
+        if (!e.pkt)
+            m_ResponseBytes -= written < left ? written : left;
+        if (written < left)
+        {
+            m_HeadSent += written;
+            break;
+        }
+        written -= left;
+        m_Head = m_Head->next;
+        m_HeadSent = 0;
+    }
+    if (zeroCopy)
+        ++m_ZeroCopyNext;
+    release();
+}
+
+bool CTcpSendQueue::flush(SOCKET sock, uint64_t *syscalls)
+{
+    if (m_Ring && (m_Flush.isPending() || m_Ring->isValid()))
+        return submit(sock);
+
+    if (m_ZeroCopyNext != m_ZeroCopyDone)
+        reap(sock);
+
+    while (m_Head)
+    {
+        iovec iov[RTP_TCP_IOV_MAX];
+        size_t bytes;
+        int iovcnt = gather(iov, &bytes);
+
+        bool zeroCopy = m_ZeroCopy && bytes >= RTP_TCP_ZEROCOPY_MIN;
+        ++*syscalls;
+        ssize_t res = socketsendvnonblocking(sock, iov, iovcnt, zeroCopy);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS && zeroCopy)
+            {
+                m_ZeroCopy = false; // out of optmem for pinned pages, copy from here on
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK; // full, flush again when writable
+        }
+        advance((size_t)res, zeroCopy);
+    }
+    return true;
+}
+
+void CTcpSendQueue::useRing(CIoUring *ring)
+{
+    if (ring && ring->isValid())
+        m_Ring = ring;
+}
+
+/**
+   io_uring flush: one sendmsg SQE over what is queued, submitted by the ring with the other
+   viewers' sends. The iovecs live here until it completes (onSent()), and until then no further
+   flush is started. MSG_DONTWAIT makes a full socket complete with -EAGAIN instead of waiting
+   in the kernel, so EPOLLOUT still tells when to try again.
+ */
+bool CTcpSendQueue::submit(SOCKET sock)
+{
+    if (m_Failed)
+        return false;
+    if (m_Flush.isPending() || !m_Head)
+        return true;
+
+    size_t bytes;
+    memset(&m_Msg, 0, sizeof(m_Msg));
+    m_Msg.msg_iov = m_Iov;
+    m_Msg.msg_iovlen = gather(m_Iov, &bytes);
+    m_Flush.queue = this;
+    if (!m_Ring->sendmsg(sock, &m_Msg, MSG_NOSIGNAL | MSG_DONTWAIT, &m_Flush))
+    {
+        // no room in the ring, this one goes out synchronously
+        CIoUring *ring = m_Ring;
+        uint64_t syscalls = 0;
+        m_Ring = NULL;
+        bool ok = flush(sock, &syscalls);
+        m_Ring = ring;
+        return ok;
+    }
+    return true;
+}
+
+void CTcpSendQueue::onSent(int res)
+{
+    if (res >= 0)
+        advance((size_t)res, false);
+    else if (res != -EAGAIN && res != -EWOULDBLOCK && res != -EINTR)
+        m_Failed = true; // the connection is closed on the next flush
+}
+
+void CTcpSendQueue::FlushOp::onComplete(int res)
+{
+    queue->onSent(res);
+}
+
+// recycle the written entries from the front that the kernel no longer needs
+void CTcpSendQueue::release()
+{
+    while (m_First && m_First != m_Head)
+    {
+        Entry *e = m_First;
+        if (e->zeroCopy && (int32_t)(e->zeroCopyId - m_ZeroCopyDone) >= 0)
+            break;
+        rtpPacketUnref(e->pkt);
+        e->pkt = NULL;
+
+        m_First = e->next;
+        if (!m_First)
+            m_Last = NULL;
+        e->next = m_Spare;
+        m_Spare = e;
+    }
+}
+
+void CTcpSendQueue::useZeroCopy(SOCKET sock)
+{
+    if (m_ZeroCopyTried)
+        return;
+    m_ZeroCopyTried = true;
+    m_ZeroCopy = socketenablezerocopy(sock);
+    if (!m_ZeroCopy)
+        printf("can't enable MSG_ZEROCOPY, copying TCP sends\n");
+}
+
+bool CTcpSendQueue::reap(SOCKET sock)
+{
+    uint32_t lo, hi;
+    bool copied;
+    int res;
+    while ((res = socketzerocopydone(sock, &lo, &hi, &copied)) >= 0)
+    {
+        if (res == 0)
+            continue;
+        // TCP completes sends in order, a notification may cover several
+        if ((int32_t)(hi + 1 - m_ZeroCopyDone) > 0)
+            m_ZeroCopyDone = hi + 1;
+        if (copied && m_ZeroCopy)
+        {
+            m_ZeroCopy = false; // deferred copies cost more than copying right away
+            printf("the kernel copies MSG_ZEROCOPY sends on this route, copying TCP sends\n");
+        }
+    }
+    release();
+
+    // without zerocopy sends EPOLLERR can only be a real error
+    return m_ZeroCopyNext != 0 && socketerror(sock) == 0;
+}
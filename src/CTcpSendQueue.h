@@ -0,0 +1,117 @@
+#pragma once
+
+#include "platglue.h"
+#include "RtpPacket.h"
+#include "CIoUring.h"
+#include <stdint.h>
+#include <string>
+
+#define RTP_TCP_DROP_BYTES (128 * 1024)      // backlog from which droppable pictures are skipped
+#define RTP_TCP_QUEUE_MAX_BYTES (512 * 1024) // backlog from which every picture is skipped up to the next IRAP
+#define RTP_TCP_IOV_MAX 256                  // iovecs per sendmsg
+#define RTP_TCP_ZEROCOPY_MIN (16 * 1024)     // smaller sends are copied, pinning pages costs more than that
+
+/**
+   Output queue of one RTP over RTSP (interleaved TCP) viewer.
+
+   Packets are written without blocking, as many as fit in one gathered sendmsg: the headers from
+   here, the payload straight from the packet buffers. What the socket does not take waits here,
+   sharing the packet buffers, until the socket is writable again (flush()). So one viewer on a
+   congested link never holds up the others.
+
+   The backlog (our queue plus what the kernel has not got acknowledged, SIOCOUTQ) is checked at the
+   start of every access unit and the whole picture is either queued or skipped, never part of it:
+   from RTP_TCP_DROP_BYTES on, pictures no other picture references (RTP_PACKET_DROPPABLE) are
+   skipped; from RTP_TCP_QUEUE_MAX_BYTES on every picture is, up to the next IRAP that finds the
+   backlog below RTP_TCP_DROP_BYTES again. The viewer sees a lower frame rate, or a freeze, instead
+   of a growing delay.
+
+   With useZeroCopy() sends of RTP_TCP_ZEROCOPY_MIN and more go out with MSG_ZEROCOPY: the kernel
+   sends from our buffers, so their entries stay queued (written) until the completion shows up in
+   the socket error queue (reap()). If the kernel reports it copied anyway, zerocopy is turned off.
+
+   With useRing() flushes become SQEs of the server's io_uring (see submit()).
+
+   RTSP responses on the same connection go through the queue too, so they never end up in the
+   middle of a packet, nor block the server when the client does not read.
+ */
+class CTcpSendQueue
+{
+public:
+    CTcpSendQueue();
+    ~CTcpSendQueue();
+
+    /// whether pkt is to be sent, called for every packet in order; decides once per access unit
+    bool admit(SOCKET sock, RtpPacket *pkt);
+    /// queue pkt with this viewer's RTP over RTSP and RTP header
+    void push(RtpPacket *pkt, const uint8_t *hdr);
+    /// queue raw bytes (an RTSP response)
+    void pushBytes(const char *data, size_t len);
+
+    /// write as much as the socket takes without blocking, false if the connection failed
+    bool flush(SOCKET sock, uint64_t *syscalls);
+
+    /// send large batches with MSG_ZEROCOPY from now on, if the socket allows it
+    void useZeroCopy(SOCKET sock);
+    /// after EPOLLERR: collect zerocopy completions, false if the socket really failed
+    bool reap(SOCKET sock);
+    /// flush through ring from now on (if it is usable); the sends go out with its next submit()
+    void useRing(CIoUring *ring);
+
+    bool empty() const { return m_Head == NULL; } // nothing left to write
+    bool wantsWrite() const { return m_Head && !m_Flush.isPending(); } // waits for the socket
+    size_t getBytes() const { return m_Bytes; }
+    size_t getResponseBytes() const { return m_ResponseBytes; } // of those, pushBytes() ones
+    size_t getBacklog(SOCKET sock) const { return m_Bytes + socketunacked(sock); } // what admit() goes by
+    uint64_t getDroppedFrames() const { return m_DroppedFrames; }
+
+private:
+    struct Entry
+    {
+        Entry *next;
+        RtpPacket *pkt; // NULL for raw bytes
+        uint8_t hdr[RTP_TCP_HEADER_SIZE + RTP_HEADER_SIZE];
+        std::string bytes;
+        size_t len;     // on the wire
+        bool zeroCopy;  // the kernel references it until send zeroCopyId completed
+        uint32_t zeroCopyId;
+    };
+
+    struct FlushOp : public CIoUringOp
+    {
+        CTcpSendQueue *queue;
+        virtual void onComplete(int res);
+    };
+
+    Entry *append();
+    void release();
+    int gather(iovec *iov, size_t *bytes);
+    void advance(size_t written, bool zeroCopy);
+    bool submit(SOCKET sock);
+    void onSent(int res);
+
+    // entries never move, zerocopy sends point into them
+    Entry *m_First;    // oldest entry
+    Entry *m_Head;     // first entry not completely written; the ones before wait for zerocopy completions
+    Entry *m_Last;
+    Entry *m_Spare;    // recycled entries
+    size_t m_HeadSent; // bytes of m_Head already written
+    size_t m_Bytes;    // queued bytes not written yet
+    size_t m_ResponseBytes; // raw bytes among them
+
+    bool m_InFrame;  // between the first and the marked last packet of an access unit
+    bool m_Dropping; // that access unit is skipped
+    bool m_Resync;   // skipping up to the next IRAP
+    uint64_t m_DroppedFrames;
+
+    bool m_ZeroCopy;           // enabled on the socket and not copied by the kernel
+    bool m_ZeroCopyTried;
+    uint32_t m_ZeroCopyNext;   // id of the next zerocopy send (the kernel counts them per socket)
+    uint32_t m_ZeroCopyDone;   // all sends before this id completed
+
+    CIoUring *m_Ring;          // io_uring backend, NULL = synchronous sends
+    FlushOp m_Flush;           // the flush in flight on it
+    iovec m_Iov[RTP_TCP_IOV_MAX];
+    msghdr m_Msg;
+    bool m_Failed;             // a ring send failed, the connection is gone
+};
@@ -0,0 +1,229 @@
+#include "CTimingWheel.h"
+#include <string.h>
+#include <time.h>
+
+#define TIMINGWHEEL_MASK (TIMINGWHEEL_SLOTS - 1)
+#define TIMINGWHEEL_MAX_DELTA ((1ULL << (TIMINGWHEEL_BITS * TIMINGWHEEL_LEVELS)) - 1)
+
+CWheelTimer::CWheelTimer()
+{
+    m_Next = NULL;
+    m_PPrev = NULL;
+    m_Wheel = NULL;
+    m_Deadline = 0;
+    m_Tick = 0;
+    m_Slot = -1;
+}
+
+CWheelTimer::~CWheelTimer()
+{
+    if (m_Wheel)
+        m_Wheel->cancel(this);
+}
+
+//===========================================================
+
+CTimingWheel::CTimingWheel(uint64_t nowNs, uint64_t tickNs)
+{
+    memset(m_Slots, 0, sizeof(m_Slots));
+    memset(m_Occupied, 0, sizeof(m_Occupied));
+    m_TickNs = tickNs;
+    m_Now = nowNs / tickNs;
+    m_Count = 0;
+    m_Expiring = false;
+}
+
+CTimingWheel::~CTimingWheel()
+{
+    for (int level = 0; level < TIMINGWHEEL_LEVELS; ++level)
+        for (int slot = 0; slot < TIMINGWHEEL_SLOTS; ++slot)
+            while (m_Slots[level][slot])
+                unlink(m_Slots[level][slot]);
+}
+
+void CTimingWheel::add(CWheelTimer *timer, uint64_t deadlineNs)
+{
+    if (timer->m_Wheel)
+        timer->m_Wheel->unlink(timer);
+
+    timer->m_Deadline = deadlineNs;
+    timer->m_Tick = (deadlineNs + m_TickNs - 1) / m_TickNs;
+    link(timer);
+
+    // the timerfd only moves forward for a timer earlier than everything else
+    if (!m_Expiring && (!getDeadline() || timer->m_Tick * m_TickNs < getDeadline()))
+        rearm();
+}
+
+void CTimingWheel::cancel(CWheelTimer *timer)
+{
+    if (timer->m_Wheel != this)
+        return;
+
+    unlink(timer);
+    if (!m_Count && !m_Expiring)
+        disarm(); // otherwise a spurious wakeup at worst
+}
+
+// put timer into the slot of the level that covers its distance from now
+void CTimingWheel::link(CWheelTimer *timer)
+{
+    if (timer->m_Tick < m_Now)
+        timer->m_Tick = m_Now; // overdue, fires with the next tick processed
+    if (timer->m_Tick - m_Now > TIMINGWHEEL_MAX_DELTA)
+        timer->m_Tick = m_Now + TIMINGWHEEL_MAX_DELTA;
+
+    uint64_t delta = timer->m_Tick - m_Now;
+    int level = 0;
+    while (level < TIMINGWHEEL_LEVELS - 1 && delta >= (1ULL << (TIMINGWHEEL_BITS * (level + 1))))
+        ++level;
+    int slot = (int)((timer->m_Tick >> (TIMINGWHEEL_BITS * level)) & TIMINGWHEEL_MASK);
+
+    CWheelTimer **head = &m_Slots[level][slot];
+    timer->m_Next = *head;
+    if (*head)
+        (*head)->m_PPrev = &timer->m_Next;
+    *head = timer;
+    timer->m_PPrev = head;
+    timer->m_Wheel = this;
+    timer->m_Slot = level * TIMINGWHEEL_SLOTS + slot;
+    m_Occupied[level][slot / 64] |= 1ULL << (slot % 64);
+    ++m_Count;
+}
+
+void CTimingWheel::unlink(CWheelTimer *timer)
+{
+    *timer->m_PPrev = timer->m_Next;
+    if (timer->m_Next)
+        timer->m_Next->m_PPrev = timer->m_PPrev;
+
+    // timers taken out of their slot for firing have m_Slot = -1
+    if (timer->m_Slot >= 0)
+    {
+        int level = timer->m_Slot / TIMINGWHEEL_SLOTS;
+        int slot = timer->m_Slot % TIMINGWHEEL_SLOTS;
+        if (!m_Slots[level][slot])
+            m_Occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+    }
+
+    timer->m_Next = NULL;
+    timer->m_PPrev = NULL;
+    timer->m_Wheel = NULL;
+    timer->m_Slot = -1;
+    --m_Count;
+}
+
+// move the timers of the current slot of level one level (or more) down
+void CTimingWheel::cascade(int level)
+{
+    int slot = (int)((m_Now >> (TIMINGWHEEL_BITS * level)) & TIMINGWHEEL_MASK);
+    CWheelTimer *timer;
+    while ((timer = m_Slots[level][slot]) != NULL)
+    {
+        unlink(timer);
+        link(timer);
+    }
+}
+
+int CTimingWheel::nextOccupied(int level, int from)
+{
+    for (int word = from / 64; word < TIMINGWHEEL_SLOTS / 64; ++word)
+    {
+        uint64_t bits = m_Occupied[level][word];
+        if (word == from / 64)
+            bits &= ~0ULL << (from % 64);
+        if (bits)
+            return word * 64 + __builtin_ctzll(bits);
+    }
+    return -1;
+}
+
+/**
+   Fire everything due at nowNs. Empty ticks are skipped with the level 0 bitmap, the higher
+   levels are cascaded whenever the ticks below wrap around.
+ */
+size_t CTimingWheel::expire(uint64_t nowNs)
+{
+    uint64_t target = nowNs / m_TickNs;
+    size_t fired = 0;
+    m_Expiring = true;
+
+    while (m_Now <= target)
+    {
+        int slot = (int)(m_Now & TIMINGWHEEL_MASK);
+        if (slot == 0)
+        {
+            // level 1 reaches the next block of ticks, every further level only when the one below wrapped
+            for (int level = 1; level < TIMINGWHEEL_LEVELS; ++level)
+            {
+                cascade(level);
+                if ((m_Now >> (TIMINGWHEEL_BITS * level)) & TIMINGWHEEL_MASK)
+                    break;
+            }
+        }
+
+        // take the due slot out first: the callbacks may re-arm (into later ticks) or cancel any timer
+        CWheelTimer *due = m_Slots[0][slot];
+        m_Slots[0][slot] = NULL;
+        m_Occupied[0][slot / 64] &= ~(1ULL << (slot % 64));
+        if (due)
+            due->m_PPrev = &due;
+        for (CWheelTimer *timer = due; timer; timer = timer->m_Next)
+            timer->m_Slot = -1;
+        ++m_Now;
+
+        CWheelTimer *timer;
+        while ((timer = due) != NULL)
+        {
+            unlink(timer);
+            timer->onTimer(nowNs);
+            ++fired;
+        }
+
+        // skip to the next occupied tick of this block, or to the start of the next block
+        if (m_Now <= target && (m_Now & TIMINGWHEEL_MASK))
+        {
+            int next = nextOccupied(0, (int)(m_Now & TIMINGWHEEL_MASK));
+            uint64_t skip = next >= 0 ? (m_Now & ~(uint64_t)TIMINGWHEEL_MASK) + next : (m_Now | TIMINGWHEEL_MASK) + 1;
+            m_Now = skip <= target ? skip : target + 1;
+        }
+    }
+
+    m_Expiring = false;
+    rearm();
+    return fired;
+}
+
+/**
+   The next occupied tick of the current block, or the start of the next block, where the next
+   level may bring timers down. So with only distant timers the wheel still wakes up once per
+   block (256 ticks).
+ */
+uint64_t CTimingWheel::nextExpiry()
+{
+    if (!m_Count)
+        return 0;
+
+    int next = nextOccupied(0, (int)(m_Now & TIMINGWHEEL_MASK));
+    if (next >= 0)
+        return ((m_Now & ~(uint64_t)TIMINGWHEEL_MASK) + next) * m_TickNs;
+    return ((m_Now | TIMINGWHEEL_MASK) + 1) * m_TickNs;
+}
+
+void CTimingWheel::rearm()
+{
+    uint64_t next = nextExpiry();
+    if (next)
+        arm(next);
+    else
+        disarm();
+}
+
+void CTimingWheel::onTimer()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    size_t fired = expire((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+    if (fired)
+        onBatch(fired);
+}
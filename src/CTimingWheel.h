@@ -0,0 +1,89 @@
+#pragma once
+
+#include "CEventLoop.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define TIMINGWHEEL_TICK_NS 100000ULL // resolution: deadlines are rounded up to 0.1 ms
+#define TIMINGWHEEL_BITS 8
+#define TIMINGWHEEL_SLOTS (1 << TIMINGWHEEL_BITS) // per level
+#define TIMINGWHEEL_LEVELS 4                     // 2^32 ticks, ~5 days at 0.1 ms
+
+class CTimingWheel;
+
+/**
+   A timer on a CTimingWheel, e.g. the frame clock of one stream. Not copyable while armed.
+ */
+class CWheelTimer
+{
+public:
+    CWheelTimer();
+    virtual ~CWheelTimer(); // cancels
+
+    bool isArmed() const { return m_Wheel != NULL; }
+    uint64_t getDeadline() const { return m_Deadline; } // CLOCK_MONOTONIC ns, as armed
+
+    /// the deadline passed, the timer is disarmed and may re-arm itself from here
+    virtual void onTimer(uint64_t nowNs) = 0;
+
+private:
+    friend class CTimingWheel;
+
+    CWheelTimer *m_Next;   // in its slot
+    CWheelTimer **m_PPrev; // the pointer to us: slot head or m_Next of the previous timer
+    CTimingWheel *m_Wheel; // armed on
+    uint64_t m_Deadline;
+    uint64_t m_Tick;       // deadline rounded up to the wheel resolution
+    int m_Slot;            // level * TIMINGWHEEL_SLOTS + slot
+};
+
+/**
+   Hierarchical timing wheel for many timers on one thread (Varghese & Lauck, as in the Linux kernel).
+
+   Arming and cancelling are O(1): a timer goes into a slot of the level that covers its distance,
+   256 ticks per level. Level 0 slots are single ticks and fire as a whole; the slots of the
+   higher levels are redistributed one level down when the ticks below them wrap around.
+   Occupancy bitmaps let expire() skip empty ticks.
+
+   Driven by its own timerfd when init() with an event loop: the fd is armed for the next tick that
+   has work, every timer due by then fires in one wakeup and onBatch() follows, so e.g. the streams
+   due in the same tick go out in one burst. Without a loop, expire() can be called directly
+   with any clock.
+ */
+class CTimingWheel : public CDeadlineTimer
+{
+public:
+    CTimingWheel(uint64_t nowNs, uint64_t tickNs = TIMINGWHEEL_TICK_NS);
+    virtual ~CTimingWheel(); // disarms the timers left
+
+    /// arm timer at deadlineNs (fires on the first tick at or after it), replaces an armed deadline
+    void add(CWheelTimer *timer, uint64_t deadlineNs);
+    void cancel(CWheelTimer *timer);
+
+    /// fire all timers due at nowNs, including ones re-armed for a time passed meanwhile, returns how many fired
+    size_t expire(uint64_t nowNs);
+    /// when expire() has work next (CLOCK_MONOTONIC ns, 0 = no timers)
+    uint64_t nextExpiry();
+
+    size_t size() const { return m_Count; }
+    uint64_t getTickNs() const { return m_TickNs; }
+
+    /// after a timerfd wakeup fired timers
+    virtual void onBatch(size_t fired) {}
+
+    virtual void onTimer();
+
+private:
+    void link(CWheelTimer *timer);
+    void unlink(CWheelTimer *timer);
+    void cascade(int level);
+    int nextOccupied(int level, int from); // first occupied slot >= from, -1 if none
+    void rearm();
+
+    CWheelTimer *m_Slots[TIMINGWHEEL_LEVELS][TIMINGWHEEL_SLOTS];
+    uint64_t m_Occupied[TIMINGWHEEL_LEVELS][TIMINGWHEEL_SLOTS / 64];
+    uint64_t m_TickNs;
+    uint64_t m_Now;      // next tick to process
+    size_t m_Count;
+    bool m_Expiring;     // inside expire(), the timerfd is re-armed once at its end
+};
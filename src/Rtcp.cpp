@@ -0,0 +1,108 @@
+/**
+ * @file Rtcp.cpp
+ * @brief RTCP sender reports and receiver report parsing
+ */
+
+#include <string.h>
+#include <time.h>
+#include "Rtcp.h"
+#include "Utils.h"
+
+#define NTP_UNIX_OFFSET 2208988800ULL /* seconds from 1900 to 1970 */
+
+uint64_t rtcpNtpNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t fraction = ((uint64_t)now.tv_nsec << 32) / 1000000000ULL;
+    return ((now.tv_sec + NTP_UNIX_OFFSET) << 32) | fraction;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+size_t rtcpBuildSenderReport(uint8_t *out, size_t size, uint32_t ssrc, uint64_t ntp, uint32_t rtpTimestamp,
+                             uint32_t packets, uint32_t octets, const char *cname)
+{
+    size_t cnameLen = strlen(cname);
+    if (cnameLen > 255)
+        cnameLen = 255;
+    /* SDES chunk: SSRC, CNAME item, at least one zero octet ending the item list, 32 bit aligned */
+    size_t sdesLen = (4 + 4 + 2 + cnameLen + 1 + 3) & ~(size_t)3;
+    if (size < 28 + sdesLen)
+        return 0;
+
+    /* SR without report blocks, we receive nothing */
+    out[0] = 0x80;
+    out[1] = RTCP_SR;
+    Load16(&out[2], 28 / 4 - 1);
+    Load32(&out[4], ssrc);
+    Load32(&out[8], (uint32_t)(ntp >> 32));
+    Load32(&out[12], (uint32_t)ntp);
+    Load32(&out[16], rtpTimestamp);
+    Load32(&out[20], packets);
+    Load32(&out[24], octets);
+
+    uint8_t *sdes = out + 28;
+    memset(sdes, 0, sdesLen);
+    sdes[0] = 0x81; /* one chunk */
+    sdes[1] = RTCP_SDES;
+    Load16(&sdes[2], (uint16_t)(sdesLen / 4 - 1));
+    Load32(&sdes[4], ssrc);
+    sdes[8] = 1; /* CNAME */
+    sdes[9] = (uint8_t)cnameLen;
+    memcpy(&sdes[10], cname, cnameLen);
+    return 28 + sdesLen;
+}
+
+size_t rtcpParseReports(const uint8_t *buf, size_t len, RtcpReportBlock *blocks, size_t max)
+{
+    size_t count = 0;
+    while (len >= 4)
+    {
+        size_t packetLen = ((size_t)((buf[2] << 8) | buf[3]) + 1) * 4;
+        if ((buf[0] >> 6) != 2 || packetLen > len)
+            break;
+
+        int blockCount = buf[0] & 0x1f;
+        size_t offset = buf[1] == RTCP_SR ? 28 : buf[1] == RTCP_RR ? 8 : 0;
+        for (int i = 0; offset && i < blockCount && offset + 24 <= packetLen && count < max; ++i, offset += 24)
+        {
+            const uint8_t *b = buf + offset;
+            RtcpReportBlock *block = &blocks[count++];
+            block->ssrc = read32(b);
+            block->fractionLost = b[4];
+            uint32_t lost = read32(b + 4) & 0xffffff;
+            block->cumulativeLost = (lost & 0x800000) ? (int32_t)(lost | 0xff000000) : (int32_t)lost;
+            block->highestSeq = read32(b + 8);
+            block->jitter = read32(b + 12);
+            block->lsr = read32(b + 16);
+            block->dlsr = read32(b + 20);
+        }
+
+        buf += packetLen;
+        len -= packetLen;
+    }
+    return count;
+}
+
+/*
+ * The round trip is the arrival time of the report less the time our SR left (LSR) and the time
+ * the receiver held it (DLSR), all in the middle 32 bits of NTP time (1/65536 s).
+ */
+void rtcpApplyReport(RtcpReceiverStats *stats, const RtcpReportBlock *block, uint64_t arrivalNtp)
+{
+    ++stats->reports;
+    stats->fractionLost = block->fractionLost;
+    stats->cumulativeLost = block->cumulativeLost;
+    stats->highestSeq = block->highestSeq;
+    stats->jitter = block->jitter;
+
+    if (!block->lsr)
+        return;
+    uint32_t rtt = (uint32_t)(arrivalNtp >> 16) - block->lsr - block->dlsr;
+    if ((int32_t)rtt >= 0)
+        stats->rttUs = (uint32_t)((uint64_t)rtt * 1000000 / 65536);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file Rtcp.h
+ * @brief RTCP sender reports and receiver report parsing (RFC 3550 section 6.4)
+ */
+
+#ifndef RTPSERVER_RTCP_H
+#define RTPSERVER_RTCP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RTCP_SR 200
+#define RTCP_RR 201
+#define RTCP_SDES 202
+
+#define RTCP_INTERVAL_MS 5000 /* mean time between the sender reports of a session (RFC 3550 minimum) */
+#define RTCP_PACKET_MAX 1500  /* what we send or receive in one datagram */
+#define RTCP_RECV_BATCH 16    /* datagrams read per recvmmsg call */
+#define RTCP_MAX_BLOCKS 64    /* report blocks looked at per compound packet */
+
+/* what a receiver reports about one of our SSRCs */
+typedef struct
+{
+    uint32_t ssrc;          /* the source reported on, ours */
+    uint8_t fractionLost;   /* since the last report, in 1/256 */
+    int32_t cumulativeLost;
+    uint32_t highestSeq;    /* extended highest sequence number received */
+    uint32_t jitter;        /* interarrival jitter, RTP timestamp units */
+    uint32_t lsr;           /* middle 32 bits of the NTP time of the last SR it got, 0 = none yet */
+    uint32_t dlsr;          /* since then until this report, 1/65536 s */
+} RtcpReportBlock;
+
+/* the receiver's view of one RTP stream, from the latest report about it */
+typedef struct
+{
+    uint64_t reports;       /* report blocks received */
+    uint8_t fractionLost;
+    int32_t cumulativeLost;
+    uint32_t highestSeq;
+    uint32_t jitter;
+    uint32_t rttUs;         /* round trip time from LSR/DLSR, 0 = not known yet */
+} RtcpReceiverStats;
+
+/* the 64 bit NTP timestamp of now (CLOCK_REALTIME) */
+uint64_t rtcpNtpNow(void);
+
+/*
+ * Build a compound SR + SDES CNAME packet into out, returns its length (0 if it does not fit).
+ * packets and octets are what went to this receiver, octets counting the RTP payload only.
+ */
+size_t rtcpBuildSenderReport(uint8_t *out, size_t size, uint32_t ssrc, uint64_t ntp, uint32_t rtpTimestamp,
+                             uint32_t packets, uint32_t octets, const char *cname);
+
+/*
+ * Collect the report blocks of the SRs and RRs in a compound packet, up to max. Returns their
+ * number, stopping at the first malformed packet of the compound.
+ */
+size_t rtcpParseReports(const uint8_t *buf, size_t len, RtcpReportBlock *blocks, size_t max);
+
+/* take a report block that arrived at arrivalNtp into stats */
+void rtcpApplyReport(RtcpReceiverStats *stats, const RtcpReportBlock *block, uint64_t arrivalNtp);
+
+#endif //RTPSERVER_RTCP_H
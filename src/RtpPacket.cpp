@@ -0,0 +1,187 @@
+/**
+ * @file RtpPacket.cpp
+ * @brief reference counted RTP packets
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "RtpPacket.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+#define RTP_POOL_SLOT_SIZE ((sizeof(RtpPacket) + 63) & ~(size_t)63) /* cache line aligned */
+#define RTP_POOL_ARENA_SLOTS (RTP_POOL_ARENA_SIZE / RTP_POOL_SLOT_SIZE)
+
+/* a free slot, linked through its first bytes */
+typedef struct PoolSlot
+{
+    struct PoolSlot *next;
+} PoolSlot;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static PoolSlot *poolFree;  /* shared free list */
+static uint64_t poolFreeCount;
+static RtpPacketPoolStats poolStats;
+static int poolHugepages;
+
+/* per thread cache, no locking on the media path */
+static __thread PoolSlot *cacheFree;
+static __thread int cacheCount;
+
+void rtpPacketPoolInit(int hugepages)
+{
+    poolHugepages = hugepages;
+}
+
+void rtpPacketPoolGetStats(RtpPacketPoolStats *stats)
+{
+    pthread_mutex_lock(&poolLock);
+    *stats = poolStats;
+    pthread_mutex_unlock(&poolLock);
+}
+
+/* map another arena onto the shared free list, poolLock held */
+static int poolGrow(void)
+{
+    void *arena = MAP_FAILED;
+    if (poolHugepages)
+    {
+        arena = mmap(NULL, RTP_POOL_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena == MAP_FAILED)
+        {
+            printf("no hugepages reserved (vm.nr_hugepages), packet pool uses transparent huge pages\n");
+            poolHugepages = 0;
+        }
+    }
+    if (arena == MAP_FAILED)
+    {
+        arena = mmap(NULL, RTP_POOL_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED)
+            return 0;
+        madvise(arena, RTP_POOL_ARENA_SIZE, MADV_HUGEPAGE);
+    }
+    else
+        poolStats.hugepages = 1;
+
+    for (size_t i = RTP_POOL_ARENA_SLOTS; i-- > 0;)
+    {
+        PoolSlot *slot = (PoolSlot *)((uint8_t *)arena + i * RTP_POOL_SLOT_SIZE);
+        slot->next = poolFree;
+        poolFree = slot;
+    }
+    poolFreeCount += RTP_POOL_ARENA_SLOTS;
+    poolStats.capacity += RTP_POOL_ARENA_SLOTS;
+    ++poolStats.arenas;
+    return 1;
+}
+
+/* refill the thread's cache with a batch from the shared list */
+static void poolRefill(void)
+{
+    pthread_mutex_lock(&poolLock);
+    if (poolFreeCount < RTP_POOL_BATCH)
+        poolGrow();
+    while (cacheCount < RTP_POOL_BATCH && poolFree)
+    {
+        PoolSlot *slot = poolFree;
+        poolFree = slot->next;
+        slot->next = cacheFree;
+        cacheFree = slot;
+        ++cacheCount;
+        --poolFreeCount;
+        ++poolStats.inUse;
+    }
+    if (poolStats.inUse > poolStats.highWater)
+        poolStats.highWater = poolStats.inUse;
+    pthread_mutex_unlock(&poolLock);
+}
+
+/* hand a batch of the thread's cache back to the shared list */
+static void poolDrain(void)
+{
+    pthread_mutex_lock(&poolLock);
+    while (cacheCount > RTP_POOL_BATCH)
+    {
+        PoolSlot *slot = cacheFree;
+        cacheFree = slot->next;
+        slot->next = poolFree;
+        poolFree = slot;
+        --cacheCount;
+        ++poolFreeCount;
+        --poolStats.inUse;
+    }
+    pthread_mutex_unlock(&poolLock);
+}
+
+RtpPacket *rtpPacketAlloc(void)
+{
+    if (!cacheFree)
+    {
+        poolRefill();
+        if (!cacheFree)
+            return NULL;
+    }
+    RtpPacket *pkt = (RtpPacket *)cacheFree;
+    cacheFree = cacheFree->next;
+    --cacheCount;
+
+    pkt->refs = 1;
+    pkt->len = RTP_HEADER_SIZE;
+    pkt->mark = 0;
+    pkt->flags = 0;
+    pkt->queued = 0;
+    pkt->due = 0;
+    pkt->chunks = 0;
+    pkt->slab_used = RTP_TCP_HEADER_SIZE + RTP_HEADER_SIZE;
+    return pkt;
+}
+
+RtpPacket *rtpPacketRef(RtpPacket *pkt)
+{
+    ++pkt->refs;
+    return pkt;
+}
+
+void rtpPacketUnref(RtpPacket *pkt)
+{
+    if (!pkt || --pkt->refs > 0)
+        return;
+
+    PoolSlot *slot = (PoolSlot *)pkt;
+    slot->next = cacheFree;
+    cacheFree = slot;
+    if (++cacheCount >= RTP_POOL_BATCH * 2)
+        poolDrain();
+}
+
+void rtpPacketAddBytes(RtpPacket *pkt, const uint8_t *data, int len)
+{
+    uint8_t *dst = &pkt->slab[pkt->slab_used];
+    memcpy(dst, data, len);
+    pkt->slab_used += len;
+
+    // glue to the previous chunk if that one ends right here in the slab
+    struct iovec *last = pkt->chunks ? &pkt->chunk[pkt->chunks - 1] : NULL;
+    if (last && (uint8_t *)last->iov_base + last->iov_len == dst)
+        last->iov_len += len;
+    else
+    {
+        pkt->chunk[pkt->chunks].iov_base = dst;
+        pkt->chunk[pkt->chunks].iov_len = len;
+        ++pkt->chunks;
+    }
+    pkt->len += len;
+}
+
+void rtpPacketAddRef(RtpPacket *pkt, const uint8_t *data, int len)
+{
+    pkt->chunk[pkt->chunks].iov_base = (void *)data;
+    pkt->chunk[pkt->chunks].iov_len = len;
+    ++pkt->chunks;
+    pkt->len += len;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file RtpPacket.h
+ * @brief reference counted RTP packets, shared by all viewers of a stream
+ */
+
+#ifndef RTPSERVER_RTPPACKET_H
+#define RTPSERVER_RTPPACKET_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include "RTPEnc.h"
+
+#define RTP_HEADER_SIZE 12
+#define RTP_TCP_HEADER_SIZE 4    // '$' + channel + length, RTP over RTSP
+#define RTP_PACKET_MAX_CHUNKS 16 // payload pieces of one packet, an aggregation packet takes 2 per NAL unit
+#define RTP_PACKET_SLAB_SIZE (RTP_TCP_HEADER_SIZE + RTP_HEADER_SIZE + 3 + RTP_PACKET_MAX_CHUNKS)
+
+/* RtpPacket::flags, the same for all packets of an access unit */
+#define RTP_PACKET_DROPPABLE 0x01 /* a picture no other picture references */
+#define RTP_PACKET_IRAP 0x02      /* decoding can start at this picture */
+
+/*
+ * A packetized RTP packet of a stream.
+ *
+ * The packet does not hold a copy of its payload. The few bytes we generate
+ * ourselves (RTP over RTSP header, RTP header, PayloadHdr/FU header and the
+ * NALU sizes of aggregation packets) live in a small header slab, the NAL unit
+ * data is referenced in place in the source buffer, which therefore must
+ * outlive the packet. The payload is described by chunk[], ready to be used
+ * as iovecs for gather I/O.
+ *
+ * The header carries the stream's own sequence number, timestamp and SSRC;
+ * senders patch in per viewer values on a copy of the header, so a packet is
+ * never modified after it was built and can be shared by any number of viewers.
+ */
+typedef struct
+{
+    int refs;
+    int len;            // RTP header + payload
+    int mark;
+    int flags;          // RTP_PACKET_xxx
+    uint16_t seq;       // stream sequence number
+    uint32_t timestamp; // stream timestamp
+    uint64_t queued;    // CLOCK_MONOTONIC ns the packet was handed to the sender
+    uint64_t due;       // paced departure time, CLOCK_MONOTONIC ns
+    int chunks;         // used entries in chunk[]
+    int slab_used;      // used bytes of slab[]
+    struct iovec chunk[RTP_PACKET_MAX_CHUNKS]; // payload, in order
+    uint8_t slab[RTP_PACKET_SLAB_SIZE];        // TCP Header (4) + RTP header (12) + generated payload bytes
+} RtpPacket;
+
+/*
+ * Packets come from a pool of fixed size slots carved out of 2 MB arenas,
+ * so the media path never calls malloc. Each thread keeps a cache of free
+ * slots and trades them with the shared free list in batches; arenas are
+ * mapped as the pool grows and never returned. With hugepages the arenas
+ * are MAP_HUGETLB (falling back to transparent huge pages if none are
+ * reserved), which keeps the packets of a whole stream in a few TLB entries.
+ */
+#define RTP_POOL_ARENA_SIZE (2 * 1024 * 1024)
+#define RTP_POOL_BATCH 64 /* slots moved between a thread's cache and the shared list at once */
+
+typedef struct
+{
+    uint64_t capacity;  /* slots in all arenas */
+    uint64_t inUse;     /* handed out to threads, including their caches (< RTP_POOL_BATCH * 2 per thread) */
+    uint64_t highWater; /* the most inUse ever */
+    int arenas;
+    int hugepages;      /* arenas are MAP_HUGETLB */
+} RtpPacketPoolStats;
+
+/* call before the first packet: back the pool with hugepages */
+void rtpPacketPoolInit(int hugepages);
+void rtpPacketPoolGetStats(RtpPacketPoolStats *stats);
+
+/* get an empty packet with refs = 1 */
+RtpPacket *rtpPacketAlloc(void);
+
+RtpPacket *rtpPacketRef(RtpPacket *pkt);
+
+/* drop a reference, the packet is released with the last one */
+void rtpPacketUnref(RtpPacket *pkt);
+
+/* append generated payload bytes, they are copied into the slab */
+void rtpPacketAddBytes(RtpPacket *pkt, const uint8_t *data, int len);
+
+/* append payload that is referenced in place */
+void rtpPacketAddRef(RtpPacket *pkt, const uint8_t *data, int len);
+
+static inline uint8_t *rtpPacketTcpHeader(RtpPacket *pkt) { return &pkt->slab[0]; }
+static inline uint8_t *rtpPacketHeader(RtpPacket *pkt) { return &pkt->slab[RTP_TCP_HEADER_SIZE]; }
+static inline int rtpPacketPayloadLen(RtpPacket *pkt) { return pkt->len - RTP_HEADER_SIZE; }
+
+#endif //RTPSERVER_RTPPACKET_H
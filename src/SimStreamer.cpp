@@ -1,43 +1,115 @@
 
 #include "SimStreamer.h"
-#include "AVC.h"
 #include "RTPEnc.h"
+#include "CFileSource.h"
 
 
-SimStreamer::SimStreamer(bool ) : CStreamer( 800 ,   480)
+SimStreamer::SimStreamer(const uint8_t *stream, int64_t stream_len, const CNalIndex *index, int fps) : CStreamer(0, 0)
 {
-  
+    initRTPMuxContext(&m_RtpCtx);
+    m_Stream = stream;
+    m_StreamLen = stream_len;
+    m_Index = index;
+    m_AuPos = 0;
+    m_Prefetched = 0;
+    m_Fps = fps;
+    m_Frame = 0;
+    m_Ticks = 0;
+    if (m_Stream && m_Index && m_Params.scan(m_Stream, *m_Index))
+        setFrameSize((u_short)m_Params.getInfo().width, (u_short)m_Params.getInfo().height);
 }
 
-void SimStreamer::streamImage(uint32_t curMsec)
+/**
+   The H.265 format parameters with the parameter sets in front of the picture being sent, so
+   a client can decode the first IRAP it gets. Our frame rate is the one we clock at.
+ */
+String SimStreamer::sdpMediaAttributes()
 {
+    char lines[96];
+    String attributes;
+    if (m_Params.hasSps())
+    {
+        attributes = "a=fmtp:96 " + m_Params.fmtp() + "\r\n";
+        snprintf(lines, sizeof(lines), "a=framesize:96 %u-%u\r\n", m_Params.getInfo().width, m_Params.getInfo().height);
+        attributes += lines;
+    }
+    snprintf(lines, sizeof(lines), "a=framerate:%d\r\n", m_Fps);
+    return attributes + lines;
 }
-void SimStreamer::StreamNal(RTPMuxContext *ctx, uint8_t *nal, int nal_len)
+
+// the next access unit is frame m_Frame, its timestamp as sendAccessUnit() sets it
+void SimStreamer::nextRtpPosition(uint16_t *seq, uint32_t *timestamp)
 {
-    rtpSendNALH265(ctx, nal, nal_len, 0);
+    *seq = (uint16_t)m_RtpCtx.seq;
+    *timestamp = (uint32_t)(m_Frame * 90000 / m_Fps);
 }
-void SimStreamer::SelectNextNal(uint8_t *&buf, int &size, uint8_t *&r, int &r_len)
+
+/**
+   Send the next access unit (picture) of our stream, called by the media clock once per frame period.
+
+   All NAL units of the access unit share one RTP timestamp, the last packet carries the marker bit
+   and all packets go out in one batch. The timestamp is derived from the frame count, so it does not
+   drift whatever the frame rate. The file is looped when its end is reached.
+
+   With smoothing the stream runs getSmoothFrames() access units ahead of the clock, so the pacer
+   can send large pictures early; their timestamps stay the same.
+ */
+void SimStreamer::streamImage(uint32_t curMsec)
 {
-    const uint8_t *end = buf + size;
-    if (NULL == buf || size <= 0)
-    {
-        printf("%s param error.\n", "rtpSendH265HEVC");
+    if (!m_Stream || !m_Index || !m_Index->count())
         return;
+
+    uint64_t tick = m_Ticks++;
+    uint64_t ahead = (uint64_t)getSmoothFrames();
+    while (m_Frame <= tick + ahead)
+        sendAccessUnit((int)(m_Frame - tick));
+}
+
+void SimStreamer::sendAccessUnit(int aheadFrames)
+{
+    size_t aus = m_Index->accessUnits();
+    size_t nal = m_Index->accessUnitNal(m_AuPos);
+    size_t end = m_AuPos + 1 < aus ? m_Index->accessUnitNal(m_AuPos + 1) : m_Index->count();
+
+    // keep the kernel reading ahead of us in mapped files
+    int64_t offset = (int64_t)m_Index->entry(nal).offset;
+    if (m_Prefetched < m_StreamLen && offset + FILESOURCE_READAHEAD / 2 >= m_Prefetched)
+    {
+        int64_t len = m_StreamLen - m_Prefetched < FILESOURCE_READAHEAD ? m_StreamLen - m_Prefetched : FILESOURCE_READAHEAD;
+        CFileSource::willNeed(m_Stream + m_Prefetched, (size_t)len);
+        m_Prefetched += len;
+    }
+
+    m_RtpCtx.timestamp = (uint32_t)(m_Frame * 90000 / m_Fps);
+
+    // a slow TCP viewer may skip pictures nothing references: sub-layer non-reference pictures
+    // (TRAIL_N, RASL_N, ...) of the highest temporal sub-layer
+    bool droppable = true, irap = false;
+    for (; nal < end; ++nal)
+    {
+        const NalIndexEntry &e = m_Index->entry(nal);
+        if (e.type < 32)
+        {
+            droppable = droppable && e.type <= 14 && !(e.type & 1) && e.tid == m_Index->maxTemporalId();
+            irap = irap || (e.flags & NAL_FLAG_IRAP);
+        }
+        else if (e.type <= H265_NAL_PPS && m_Params.update(m_Stream + e.offset, e.length))
+            invalidateResponses(); // new parameter sets, the next DESCRIBE gets them
+        rtpSendNALH265(&m_RtpCtx, m_Stream + e.offset, (int)e.length, nal + 1 == end);
+    }
+    setAccessUnitFlags((droppable ? RTP_PACKET_DROPPABLE : 0) | (irap ? RTP_PACKET_IRAP : 0));
+
+    // the pacer looks as far ahead as the stream may run ahead
+    m_NextBytes.resize((size_t)getSmoothFrames());
+    for (size_t i = 0; i < m_NextBytes.size(); ++i)
+        m_NextBytes[i] = m_Index->accessUnitBytes((m_AuPos + 1 + i) % aus);
+
+    if (++m_AuPos == aus)
+    {
+        m_AuPos = 0;
+        m_Prefetched = 0;
     }
-    r = (uint8_t *)ff_avc_find_startcode(buf, end);
-
-    /*
-    startcode
-    r[0]:  0x00
-    r[1]:  0x00
-    r[2]:  0x00
-    r[3]:  0x01
-    */
-    const uint8_t *r1;
-    while (!*(r++))
-        ; // skip current startcode
-    r1 = ff_avc_find_startcode(r, end); // find next startcode
-    r_len = (int)(r1 - r);
-    buf = (uint8_t *)r1;
-    size = size - r_len - 4;
+
+    sendPackets(aheadFrames, m_NextBytes.data(), m_NextBytes.size());
+    ++m_Frame;
 }
@@ -1,17 +1,32 @@
 #pragma once
 
 #include "CStreamer.h"
+#include "CNalIndex.h"
+#include "CH265ParamSets.h"
 
 class SimStreamer : public CStreamer
 {
-    bool m_showBig;
-   
-
 public:
-    SimStreamer(bool );
-    void SelectNextNal(uint8_t *&buf, int &size, uint8_t *&r, int &r_len);
-    void StreamNal(RTPMuxContext *ctx, uint8_t *nal, int nal_len);
+    SimStreamer(const uint8_t *stream, int64_t stream_len, const CNalIndex *index, int fps); // streamImage() walks over the indexed NAL units of this Annex-B buffer
 
     virtual void streamImage(uint32_t curMsec);
-};
 
+protected:
+    virtual String sdpMediaAttributes();
+    virtual void nextRtpPosition(uint16_t *seq, uint32_t *timestamp);
+
+private:
+    void sendAccessUnit(int aheadFrames);
+
+    RTPMuxContext m_RtpCtx; // packetizer state of our own stream
+    const uint8_t *m_Stream; // whole (mapped) file, not owned
+    int64_t m_StreamLen;
+    const CNalIndex *m_Index; // NAL units of m_Stream, not owned
+    size_t m_AuPos;           // next access unit
+    int64_t m_Prefetched;     // readahead was requested up to this offset
+    int m_Fps;
+    CH265ParamSets m_Params;  // the ones last sent, for the SDP
+    uint64_t m_Frame;         // access units sent, the media clock
+    uint64_t m_Ticks;         // streamImage() calls, with smoothing m_Frame runs up to getSmoothFrames() ahead
+    std::vector<uint64_t> m_NextBytes; // sizes of the access units after the one being sent, for the pacer
+};
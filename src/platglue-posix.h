@@ -1,7 +1,12 @@
 #pragma once
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
@@ -9,6 +14,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include <string>
 typedef std::string String;
@@ -43,6 +49,17 @@ inline void socketpeeraddr(SOCKET s, IPADDRESS *addr, IPPORT *port) {
     }
 }
 
+// our end of a connected socket, 0 if unknown
+inline void socketlocaladdr(SOCKET s, IPADDRESS *addr) {
+
+    sockaddr_in r;
+    socklen_t len = sizeof(r);
+    if(getsockname(s,(struct sockaddr*)&r,&len) < 0 || r.sin_family != AF_INET)
+        *addr = 0;
+    else
+        *addr = r.sin_addr.s_addr;
+}
+
 inline void udpsocketclose(UDPSOCKET s) {
     close(s);
 }
@@ -65,6 +82,35 @@ inline UDPSOCKET udpsocketcreate(unsigned short portNum)
     return s;
 }
 
+// let further sockets bind localPort of s too (see udpsocketcreateconnected), they all need SO_REUSEADDR
+inline bool udpsocketshareport(UDPSOCKET s)
+{
+    int enable = 1;
+    return setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == 0;
+}
+
+// a UDP socket sending from localPort (shared, see udpsocketshareport) to dest only: connect()
+// resolves the route once, sends need no address. Returns 0 on failure.
+inline UDPSOCKET udpsocketcreateconnected(unsigned short localPort, const sockaddr_in *dest)
+{
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (s < 0)
+        return 0;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(localPort);
+    if (!udpsocketshareport(s) || bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        connect(s, (const sockaddr *)dest, sizeof(*dest)) != 0)
+    {
+        close(s);
+        return 0;
+    }
+    return s;
+}
+
 // TCP sending
 inline ssize_t socketsend(SOCKET sockfd, const void *buf, size_t len)
 {
@@ -85,20 +131,203 @@ inline ssize_t udpsocketsend(UDPSOCKET sockfd, const void *buf, size_t len,
     return sendto(sockfd, buf, len, 0, (sockaddr *) &addr, sizeof(addr));
 }
 
+// TCP gather sending, the iovecs are sent as one contiguous chunk
+inline ssize_t socketsendv(SOCKET sockfd, const struct iovec *iov, int iovcnt)
+{
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+}
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// TCP gather sending that never blocks: returns the bytes the socket took, or -1 with EAGAIN when it is full.
+// With zerocopy (see socketenablezerocopy) the kernel sends from our buffers in place, they must stay
+// untouched until socketzerocopydone() reports the send complete.
+inline ssize_t socketsendvnonblocking(SOCKET sockfd, const struct iovec *iov, int iovcnt, bool zerocopy = false)
+{
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg(sockfd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT | (zerocopy ? MSG_ZEROCOPY : 0));
+}
+
+// allow MSG_ZEROCOPY sends on a TCP socket (Linux 4.14)
+inline bool socketenablezerocopy(SOCKET sockfd)
+{
+    int enable = 1;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+}
+
+// read one message of the socket error queue. Returns 1 for a zerocopy completion: the sends [*lo, *hi]
+// (numbered from 0 per socket) are done, *copied if the kernel copied the data after all (e.g. loopback).
+// 0 for other messages, -1 if the queue is empty.
+inline int socketzerocopydone(SOCKET sockfd, uint32_t *lo, uint32_t *hi, bool *copied)
+{
+    char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        return -1;
+
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            continue;
+        const sock_extended_err *err = (const sock_extended_err *)CMSG_DATA(cm);
+        if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            continue;
+        *lo = err->ee_info;
+        *hi = err->ee_data;
+        *copied = (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+        return 1;
+    }
+    return 0;
+}
+
+// the pending error of a socket (SO_ERROR), 0 if none
+inline int socketerror(SOCKET sockfd)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+        return errno;
+    return err;
+}
+
+// bytes in the TCP send buffer the peer has not acknowledged yet (SIOCOUTQ), 0 if unknown
+inline size_t socketunacked(SOCKET sockfd)
+{
+    int bytes = 0;
+    if (ioctl(sockfd, SIOCOUTQ, &bytes) != 0 || bytes < 0)
+        return 0;
+    return (size_t)bytes;
+}
+
+// UDP batch sending, returns the number of datagrams handed to the kernel or -1.
+// *calls is increased by the number of sendmmsg calls it took.
+inline int udpsocketsendmmsg(UDPSOCKET sockfd, struct mmsghdr *msgs, unsigned n, uint64_t *calls)
+{
+    unsigned done = 0;
+    while (done < n)
+    {
+        ++*calls;
+        int res = sendmmsg(sockfd, msgs + done, n - done, 0);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return done ? (int)done : -1;
+        }
+        done += res;
+    }
+    return done;
+}
+
+// UDP batch receiving without blocking: the datagrams waiting, up to n, or -1 (EAGAIN if none)
+inline int udpsocketrecvmmsg(UDPSOCKET sockfd, struct mmsghdr *msgs, unsigned n)
+{
+    int res;
+    do
+        res = recvmmsg(sockfd, msgs, n, MSG_DONTWAIT, NULL);
+    while (res < 0 && errno == EINTR);
+    return res;
+}
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// UDP generic segmentation offload: the iovecs hold back to back datagrams of segsize bytes
+// (the last one may be shorter), the kernel splits them. Fails with EIO/EINVAL if unsupported.
+inline ssize_t udpsocketsendgso(UDPSOCKET sockfd, const struct iovec *iov, int iovcnt, uint16_t segsize,
+                                const sockaddr_in *dest)
+{
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)dest;
+    msg.msg_namelen = dest ? sizeof(*dest) : 0; // NULL on connected sockets
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segsize, sizeof(segsize));
+
+    return sendmsg(sockfd, &msg, 0);
+}
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+// earliest departure time (EDT) sending: every datagram carries a CLOCK_MONOTONIC time in a
+// SCM_TXTIME cmsg and the fq qdisc holds it back until then. Fails if the kernel is too old.
+inline bool udpsocketenabletxtime(UDPSOCKET sockfd)
+{
+    struct
+    {
+        clockid_t clockid;
+        uint32_t flags;
+    } txtime = {CLOCK_MONOTONIC, 0}; // struct sock_txtime
+    return setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0;
+}
+
+#define UDP_TXTIME_CONTROL_SIZE CMSG_SPACE(sizeof(uint64_t))
+
+// attach a departure time to a datagram, control must hold UDP_TXTIME_CONTROL_SIZE bytes
+inline void udpmsgsettxtime(msghdr *msg, char *control, uint64_t txtimeNs)
+{
+    memset(control, 0, UDP_TXTIME_CONTROL_SIZE);
+    msg->msg_control = control;
+    msg->msg_controllen = UDP_TXTIME_CONTROL_SIZE;
+
+    cmsghdr *cm = CMSG_FIRSTHDR(msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cm), &txtimeNs, sizeof(txtimeNs));
+}
+
 /**
-   Read from a socket with a timeout.
+   Read from a socket with a timeout, 0 = only what is there already (the socket became readable).
 
    Return 0=socket was closed by client, -1=timeout, >0 number of bytes read
  */
 inline int socketread(SOCKET sock, char *buf, size_t buflen, int timeoutmsec)
 {
-    // Use a timeout on our socket read to instead serve frames
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = timeoutmsec * 1000; // send a new frame ever
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    int res;
+    if (timeoutmsec <= 0)
+        res = recv(sock, buf, buflen, MSG_DONTWAIT);
+    else
+    {
+        // Use a timeout on our socket read to instead serve frames
+        struct timeval tv;
+        tv.tv_sec = timeoutmsec / 1000;
+        tv.tv_usec = (timeoutmsec % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        res = recv(sock, buf, buflen, 0);
+    }
 
-    int res = recv(sock,buf,buflen,0);
     if(res > 0) {
         return res;
     }
@@ -106,7 +335,7 @@ inline int socketread(SOCKET sock, char *buf, size_t buflen, int timeoutmsec)
         return 0; // client dropped connection
     }
     else {
-        if (errno == EWOULDBLOCK || errno == EAGAIN)
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)
             return -1;
         else
             return 0; // unknown error, just claim client dropped it